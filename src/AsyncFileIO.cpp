@@ -0,0 +1,179 @@
+#include "AsyncFileIO.h"
+#include "BoundedQueue.h"
+#include "IoUringFileIO.h"
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <thread>
+#include <utility>
+
+namespace
+{
+    constexpr std::size_t ReadChunkSize = 1 << 20;
+
+    // 读取整个文件，空文件按失败处理。管道、/dev/stdin 无法定位到末尾，procfs 等文件报告的大小为 0，
+    // 这两种情况分块读到文件末尾
+    bool readWholeFile(const std::filesystem::path &path, std::vector<AsyncFileIO::uchar> &bytes)
+    {
+        std::ifstream file{path, std::ios::binary};
+        if (!file)
+            return false;
+        std::streamoff size = file.seekg(0, std::ios::end) ? static_cast<std::streamoff>(file.tellg()) : -1;
+        file.clear();
+        if (size > 0 && file.seekg(0))
+        {
+            bytes.resize(static_cast<std::size_t>(size));
+            return file.read(reinterpret_cast<char *>(bytes.data()), size).good();
+        }
+
+        file.clear();
+        bytes.clear();
+        for (std::size_t used = 0;;)
+        {
+            bytes.resize(used + ReadChunkSize);
+            file.read(reinterpret_cast<char *>(bytes.data() + used), ReadChunkSize);
+            used += static_cast<std::size_t>(file.gcount());
+            if (!file)
+            {
+                bytes.resize(used);
+                return file.eof() && used > 0;
+            }
+        }
+    }
+
+    // 线程池后端：每个线程一次做一个阻塞的读写，在途请求数等于线程数
+    class ThreadFileIO final : public AsyncFileIO
+    {
+    public:
+        ThreadFileIO(uint32_t threads)
+        {
+            for (uint32_t i = 0; i < std::max(threads, 1u); ++i)
+            {
+                this->mThreads.emplace_back([this] {
+                    while (std::optional<std::function<void()>> job = this->mJobs.pop())
+                    {
+                        // 异常逃出线程函数会终止整个进程
+                        try
+                        {
+                            (*job)();
+                        } catch (const std::exception &e)
+                        {
+                            std::cerr << "Error: File I/O job failed: " << e.what() << '\n';
+                        }
+                    }
+                });
+            }
+        }
+
+        ~ThreadFileIO() override
+        {
+            this->mJobs.close();
+            this->mThreads.clear();
+        }
+
+        const char *name() const override { return "threads"; }
+
+        void read(std::filesystem::path path, ReadCallback callback) override
+        {
+            this->mJobs.push([this, path = std::move(path), callback = std::move(callback)] {
+                std::vector<uchar> bytes = this->mReadBuffers.acquire();
+                bool               ok = false;
+                try
+                {
+                    ok = readWholeFile(path, bytes);
+                } catch (const std::exception &e)
+                {
+                    std::cerr << "Error: Failed to read " << path.string() << ": " << e.what() << '\n';
+                }
+                if (!ok)
+                {
+                    this->mReadBuffers.release(std::move(bytes));
+                    callback(false, {});
+                    return;
+                }
+                const uchar *data = bytes.data();
+                std::size_t  size = bytes.size();
+                callback(true, Buffer{this, -1, data, size, std::move(bytes)});
+            });
+        }
+
+        void write(std::filesystem::path path, std::vector<uchar> &&bytes, WriteCallback callback) override
+        {
+            this->mJobs.push([path = std::move(path), bytes = std::move(bytes), callback = std::move(callback)]() mutable {
+                std::ofstream file{path, std::ios::binary | std::ios::trunc};
+                bool          ok = file.write(reinterpret_cast<const char *>(bytes.data()), bytes.size()).good();
+                file.close();
+                callback(ok && !file.fail(), std::move(bytes));
+            });
+        }
+
+    private:
+        // 在途请求数由调用方限制，这里不设上限
+        BoundedQueue<std::function<void()>> mJobs{std::numeric_limits<std::size_t>::max()};
+        std::vector<std::jthread>           mThreads;
+    };
+} // namespace
+
+AsyncFileIO::Buffer::Buffer(AsyncFileIO *owner, int slot, const uchar *data, std::size_t size, std::vector<uchar> &&heap) :
+    mOwner(owner),
+    mSlot(slot),
+    mData(data),
+    mSize(size),
+    mHeap(std::move(heap))
+{
+}
+
+AsyncFileIO::Buffer::Buffer(Buffer &&other) noexcept :
+    mOwner(std::exchange(other.mOwner, nullptr)),
+    mSlot(std::exchange(other.mSlot, -1)),
+    mData(std::exchange(other.mData, nullptr)),
+    mSize(std::exchange(other.mSize, 0)),
+    mHeap(std::move(other.mHeap))
+{
+}
+
+AsyncFileIO::Buffer &AsyncFileIO::Buffer::operator=(Buffer &&other) noexcept
+{
+    if (this != &other)
+    {
+        this->reset();
+        this->mOwner = std::exchange(other.mOwner, nullptr);
+        this->mSlot = std::exchange(other.mSlot, -1);
+        this->mData = std::exchange(other.mData, nullptr);
+        this->mSize = std::exchange(other.mSize, 0);
+        this->mHeap = std::move(other.mHeap);
+    }
+    return *this;
+}
+
+AsyncFileIO::Buffer::~Buffer()
+{
+    this->reset();
+}
+
+void AsyncFileIO::Buffer::reset()
+{
+    if (this->mOwner)
+        this->mOwner->releaseBuffer(this->mSlot, std::move(this->mHeap));
+    this->mOwner = nullptr;
+    this->mSlot = -1;
+    this->mData = nullptr;
+    this->mSize = 0;
+}
+
+void AsyncFileIO::releaseBuffer(int, std::vector<uchar> &&heap)
+{
+    this->mReadBuffers.release(std::move(heap));
+}
+
+std::unique_ptr<AsyncFileIO> AsyncFileIO::create(Backend backend, uint32_t depth, uint32_t threads)
+{
+    if (backend != Backend::Threads)
+    {
+        if (std::unique_ptr<AsyncFileIO> io = IoUringFileIO::create(depth))
+            return io;
+        if (backend == Backend::IoUring)
+            return nullptr;
+    }
+    return std::make_unique<ThreadFileIO>(threads);
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "BufferPool.h"
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// 批量模式的异步文件读写，同时保持多个请求在途，高延迟的存储（NVMe 深队列、网络文件系统）上不会每次只等一个请求。
+// Linux 上优先用 io_uring，不可用时退回线程池里的阻塞读写。回调在后端的线程上执行，不能阻塞
+class AsyncFileIO
+{
+public:
+    using uchar = unsigned char;
+
+    // 读到的文件内容，析构时把内存交还给后端，给之后的读取复用
+    class Buffer
+    {
+    public:
+        Buffer() = default;
+        Buffer(AsyncFileIO *owner, int slot, const uchar *data, std::size_t size, std::vector<uchar> &&heap);
+        Buffer(Buffer &&other) noexcept;
+        Buffer &operator=(Buffer &&other) noexcept;
+        ~Buffer();
+
+        const uchar *data() const { return this->mData; }
+        std::size_t  size() const { return this->mSize; }
+
+    private:
+        void reset();
+
+        AsyncFileIO       *mOwner = nullptr;
+        int                mSlot = -1; // 后端注册缓冲区的下标，-1 表示内容在 mHeap 里
+        const uchar       *mData = nullptr;
+        std::size_t        mSize = 0;
+        std::vector<uchar> mHeap;
+    };
+
+    // 失败时 buffer 为空
+    using ReadCallback = std::function<void(bool ok, Buffer &&buffer)>;
+    // 写入的数据原样交回，调用方可以复用它的容量
+    using WriteCallback = std::function<void(bool ok, std::vector<uchar> &&bytes)>;
+
+    enum class Backend : uint8_t
+    {
+        Auto = 0, // 能用 io_uring 就用，否则用线程池
+        IoUring,  // 不可用时 create 返回空
+        Threads
+    };
+
+    // depth 为同时在途的请求数上限，超出的请求排队；threads 只用于线程池后端
+    static std::unique_ptr<AsyncFileIO> create(Backend backend, uint32_t depth, uint32_t threads);
+
+    virtual ~AsyncFileIO() = default;
+
+    virtual const char *name() const = 0;
+
+    // 读取整个文件
+    virtual void read(std::filesystem::path path, ReadCallback callback) = 0;
+
+    // 创建或覆盖文件，所在目录须已存在
+    virtual void write(std::filesystem::path path, std::vector<uchar> &&bytes, WriteCallback callback) = 0;
+
+    // 释放留存待复用的读缓冲区，内存压力大时调用
+    void trimBuffers() { this->mReadBuffers.clear(); }
+
+    // 留存的读缓冲区个数上限，同时在途的读取不会更多，调用方按自己的读取深度设置
+    void setReadBufferPoolSize(std::size_t count) { this->mReadBuffers.setMaxBuffers(count); }
+
+    // 留存的读缓冲区不计入 Compressor 的内存预算，总量单独限制；更大的文件读完后直接释放
+    static constexpr std::size_t PooledReadBuffers = 32;
+    static constexpr std::size_t MaxPooledReadBuffer = 64ull << 20;
+    static constexpr std::size_t ReadBufferPoolBudget = 256ull << 20;
+
+protected:
+    // Buffer 析构时调用。slot 为 -1 时 heap 交回 mReadBuffers
+    virtual void releaseBuffer(int slot, std::vector<uchar> &&heap);
+
+    BufferPool mReadBuffers{PooledReadBuffers, MaxPooledReadBuffer, ReadBufferPoolBudget};
+};
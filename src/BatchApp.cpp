@@ -0,0 +1,396 @@
+#include "BatchApp.h"
+#include "BatchPipeline.h"
+#include "CommandLine.h"
+#include <algorithm>
+#include <charconv>
+#include <cwctype>
+#include <fstream>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace
+{
+    namespace fs = std::filesystem;
+
+    struct BatchItem
+    {
+        fs::path input;
+        fs::path relative; // 在输出目录下的相对路径，扩展名尚未替换
+    };
+
+    struct BatchOptions
+    {
+        fs::path                   outputDir;
+        Compressor::Params         param;
+        Compressor::Params::Format format = Compressor::Params::_count; // _count 表示沿用输入的格式
+    };
+
+    static constexpr std::size_t DefaultMemoryBudget = 1ull << 30;
+    static constexpr uint32_t    DefaultIoThreads = 16;
+
+    std::string toLower(std::string text)
+    {
+        for (char &c : text)
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        return text;
+    }
+
+    // 判断两个路径是否指向同一文件的键：转为绝对路径后词法规范化，Windows 上不区分大小写。不访问文件系统
+    fs::path::string_type pathKey(const fs::path &path)
+    {
+        std::error_code       ec;
+        fs::path              absolute = fs::absolute(path, ec);
+        fs::path::string_type key = (ec ? path : absolute).lexically_normal().native();
+#ifdef _WIN32
+        for (wchar_t &c : key)
+            c = static_cast<wchar_t>(std::towlower(c));
+#endif
+        return key;
+    }
+
+    // 键 dir 所指的目录是否为键 path 所指路径本身或其上级目录
+    bool isWithin(const fs::path::string_type &path, const fs::path::string_type &dir)
+    {
+        if (!path.starts_with(dir))
+            return false;
+        return path.size() == dir.size() || fs::path::preferred_separator == path[dir.size()] || dir.ends_with(fs::path::preferred_separator);
+    }
+
+    // 遍历目录时只挑这些扩展名的文件，显式给出的文件与通配符匹配到的文件不受限制
+    bool isImageFile(const fs::path &path)
+    {
+        static constexpr std::string_view extensions[] = {".jpg", ".jpeg", ".jpe", ".png", ".webp", ".bmp", ".tif", ".tiff",
+                                                          ".jp2", ".pbm", ".pgm", ".ppm", ".pnm", ".exr", ".hdr"};
+        return std::ranges::find(extensions, toLower(path.extension().string())) != std::end(extensions);
+    }
+
+    // 通配符匹配：* 与 ? 不跨越 '/'，** 匹配任意层目录（"**/" 也匹配零层），[...] 为字符集合，支持 ! 取反与 a-z 区间
+    bool globMatch(std::string_view pattern, std::string_view text)
+    {
+        while (!pattern.empty())
+        {
+            if (pattern.starts_with("**"))
+            {
+                pattern.remove_prefix(2);
+                if (pattern.starts_with('/') && globMatch(pattern.substr(1), text))
+                    return true;
+                for (std::size_t i = 0; i <= text.size(); ++i)
+                {
+                    if (globMatch(pattern, text.substr(i)))
+                        return true;
+                }
+                return false;
+            }
+            if (pattern.front() == '*')
+            {
+                pattern.remove_prefix(1);
+                for (std::size_t i = 0; i <= text.size(); ++i)
+                {
+                    if (globMatch(pattern, text.substr(i)))
+                        return true;
+                    if (i < text.size() && text[i] == '/')
+                        break;
+                }
+                return false;
+            }
+            if (text.empty() || (text.front() == '/' && pattern.front() != '/'))
+                return false;
+
+            char        c = text.front();
+            std::size_t consumed = 1;
+            bool        negate = pattern.size() > 1 && (pattern[1] == '!' || pattern[1] == '^');
+            std::size_t close = pattern.front() == '[' ? pattern.find(']', negate ? 3 : 2) : std::string_view::npos;
+            if (close != std::string_view::npos)
+            {
+                std::string_view set = pattern.substr(negate ? 2 : 1, close - (negate ? 2 : 1));
+                bool             matched = false;
+                for (std::size_t i = 0; i < set.size(); ++i)
+                {
+                    if (i + 2 < set.size() && set[i + 1] == '-')
+                    {
+                        matched |= set[i] <= c && c <= set[i + 2];
+                        i += 2;
+                    }
+                    else
+                    {
+                        matched |= set[i] == c;
+                    }
+                }
+                if (matched == negate)
+                    return false;
+                consumed = close + 1;
+            }
+            else if (pattern.front() != '?' && pattern.front() != c)
+            {
+                return false;
+            }
+            pattern.remove_prefix(consumed);
+            text.remove_prefix(1);
+        }
+        return text.empty();
+    }
+
+    // 递归遍历时跳过键为 skip 的子目录（输出目录），输出目录在输入目录里面时不会把刚写出的结果再压缩一遍
+    template <typename Visit>
+    void walkDirectory(const fs::path &dir, bool recursive, const fs::path::string_type &skip, Visit &&visit)
+    {
+        std::error_code ec;
+        if (recursive)
+        {
+            for (fs::recursive_directory_iterator iter{dir, fs::directory_options::skip_permission_denied, ec}, end; !ec && iter != end; iter.increment(ec))
+            {
+                if (iter->is_directory(ec) && pathKey(iter->path()) == skip)
+                    iter.disable_recursion_pending();
+                else if (iter->is_regular_file(ec))
+                    visit(iter->path());
+            }
+        }
+        else
+        {
+            for (fs::directory_iterator iter{dir, ec}, end; !ec && iter != end; iter.increment(ec))
+            {
+                if (iter->is_regular_file(ec))
+                    visit(iter->path());
+            }
+        }
+        if (ec)
+            std::cerr << "Warning: Failed to read directory: " << dir.string() << ": " << ec.message() << '\n';
+    }
+
+    // 单个文件在输出目录下的位置：不越出当前目录的相对路径原样保留，否则只取文件名
+    fs::path relativeFor(const fs::path &input)
+    {
+        fs::path normal = input.lexically_normal();
+        if (normal.is_relative() && !normal.empty() && *normal.begin() != "..")
+            return normal;
+        return input.filename();
+    }
+
+    // 把一个输入展开成文件：目录递归遍历，相对路径以目录为根；
+    // 通配符以第一个通配符之前的目录为根遍历；其余当作单个文件
+    template <typename Emit>
+    void expandInput(const std::string &input, bool allowGlob, const fs::path::string_type &outputKey, Emit &&emit)
+    {
+        std::string pattern = fs::path(input).generic_string();
+        std::size_t wildcard = allowGlob ? pattern.find_first_of("*?[") : std::string::npos;
+        if (wildcard != std::string::npos)
+        {
+            std::size_t slash = pattern.rfind('/', wildcard);
+            fs::path    base = slash == std::string::npos ? fs::path(".") : fs::path(pattern.substr(0, slash + 1));
+            std::string rest = slash == std::string::npos ? pattern : pattern.substr(slash + 1);
+            bool        recursive = rest.find('/') != std::string::npos || rest.find("**") != std::string::npos;
+            walkDirectory(base, recursive, outputKey, [&](const fs::path &path) {
+                fs::path relative = path.lexically_relative(base);
+                if (globMatch(rest, relative.generic_string()))
+                    emit(BatchItem{path, relative});
+            });
+            return;
+        }
+
+        std::error_code ec;
+        if (fs::is_directory(input, ec))
+        {
+            walkDirectory(input, true, outputKey, [&](const fs::path &path) {
+                if (isImageFile(path))
+                    emit(BatchItem{path, path.lexically_relative(input)});
+            });
+        }
+        else
+        {
+            emit(BatchItem{input, relativeFor(input)});
+        }
+    }
+
+    // 从文件或标准输入（"-"）逐个读取路径，separator 为 '\n' 或 '\0'
+    template <typename Emit>
+    bool readFileList(const std::string &source, char separator, const fs::path::string_type &outputKey, Emit &&emit)
+    {
+        std::ifstream file;
+        if (source != "-")
+        {
+            file.open(source, std::ios::binary);
+            if (!file)
+                return false;
+        }
+        std::istream &stream = source == "-" ? std::cin : file;
+        for (std::string line; std::getline(stream, line, separator);)
+        {
+            if (separator == '\n' && line.ends_with('\r'))
+                line.pop_back();
+            if (!line.empty())
+                expandInput(line, false, outputKey, emit);
+        }
+        return true;
+    }
+
+    // 正整数选项，没有给出时保持 value 不变
+    bool parseCount(const CommandLine &cmd, const std::string &name, uint32_t &value)
+    {
+        const std::string *text = cmd.option(name);
+        if (!text)
+            return true;
+        auto [end, ec] = std::from_chars(text->data(), text->data() + text->size(), value);
+        return ec == std::errc{} && end == text->data() + text->size() && value > 0;
+    }
+
+    void printUsage(const char *program)
+    {
+        std::cerr << "Usage: " << program << " --batch --output-dir=<dir> [options] <input>...\n"
+                  << "  <input>: Image file, directory (searched recursively) or quoted glob (e.g. \"photos/**/*.jpg\")\n"
+                  << "  --output-dir=<dir>: Outputs keep their path relative to the input directory or glob base under <dir>\n"
+                  << "  --files-from=<file>: Also read inputs from <file>, one per line (\"-\" for stdin)\n"
+                  << "  --null: Inputs in --files-from are separated by NUL instead of newline (e.g. find -print0)\n"
+                  << "  --quality=<quality>: Compression quality (0-100, default: 80)\n"
+                  << "  --scale=<scale>: Scaling factor (0-1, default: 1.0)\n"
+                  << "  --gray: Convert to grayscale\n"
+                  << "  --format=<jpg|png|webp>: Output format (default: keep the input format, JPEG if it is not supported)\n"
+                  << "  --memory=<size>: Memory budget for images waiting to be compressed (default: 1G)\n"
+                  << "  --read-depth=<n>: Files being read or waiting to be decoded (default: 32)\n"
+                  << "  --write-depth=<n>: Files being written at once (default: 32)\n"
+                  << "  --decode-threads=<n>: Threads decoding images (default: same as --threads)\n"
+                  << "  --max-decoded=<n>: Decoded images held in memory at once (default: twice --threads)\n"
+                  << "  --io=<auto|uring|threads>: File I/O backend (default: io_uring when available)\n"
+                  << "  --io-threads=<n>: Threads of the thread-pool I/O backend (default: 16)\n"
+                  << CommandLine::compressOptionsUsage();
+    }
+} // namespace
+
+int BatchApp::start(int argc, char *argv[])
+{
+    CommandLine  cmd{argc, argv};
+    BatchOptions options;
+    uint32_t     threads = 0;
+    std::size_t  memoryBudget = DefaultMemoryBudget;
+    bool         ok = cmd.parseCompressOptions(options.param, threads);
+
+    // 解码与编码默认同样多的线程，解码后的图像最多驻留两倍于此
+    BatchPipeline::Limits limits{.decodeThreads = threads, .maxDecoded = threads * 2};
+    auto                  ioBackend = AsyncFileIO::Backend::Auto;
+    uint32_t              ioThreads = DefaultIoThreads;
+
+    const std::string *outputDir = cmd.option("output-dir");
+    const std::string *fileList = cmd.option("files-from");
+    ok = ok && outputDir && !outputDir->empty() && (!cmd.positional.empty() || fileList);
+    if (const std::string *value = cmd.option("quality"))
+        ok = ok && CommandLine::parseQuality(*value, options.param.quality);
+    if (const std::string *value = cmd.option("scale"))
+    {
+        options.param.scale = CommandLine::parsePositive(*value);
+        ok = ok && options.param.scale > 0.0 && options.param.scale <= 1.0;
+    }
+    if (const std::string *value = cmd.option("format"))
+    {
+        options.format = CommandLine::parseFormat("." + *value);
+        ok = ok && options.format != Compressor::Params::_count;
+    }
+    if (const std::string *value = cmd.option("memory"))
+    {
+        memoryBudget = CommandLine::parseByteSize(*value);
+        ok = ok && memoryBudget != 0;
+    }
+    ok = ok && parseCount(cmd, "read-depth", limits.readDepth) && parseCount(cmd, "write-depth", limits.writeDepth)
+      && parseCount(cmd, "decode-threads", limits.decodeThreads) && parseCount(cmd, "max-decoded", limits.maxDecoded)
+      && parseCount(cmd, "io-threads", ioThreads);
+    if (const std::string *value = cmd.option("io"))
+    {
+        if (*value == "uring")
+            ioBackend = AsyncFileIO::Backend::IoUring;
+        else if (*value == "threads")
+            ioBackend = AsyncFileIO::Backend::Threads;
+        else
+            ok = ok && *value == "auto";
+    }
+    options.param.toGray = cmd.option("gray") != nullptr;
+    if (!ok)
+    {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    options.outputDir = *outputDir;
+
+    // 每个文件只压缩一次，关掉两级缓存，也省去每张图的哈希
+    Compressor compressor{threads};
+    compressor.setStageCacheBudget(0);
+    compressor.setOutputCacheBudget(0);
+    compressor.setMemoryBudget(memoryBudget, Compressor::Backpressure::Block);
+    compressor.setMemoryPressureMonitor(true);
+
+    std::unique_ptr<AsyncFileIO> io = AsyncFileIO::create(ioBackend, limits.readDepth + limits.writeDepth, ioThreads);
+    if (!io)
+    {
+        std::cerr << "Error: io_uring is not available\n";
+        return EXIT_FAILURE;
+    }
+
+    BatchPipeline pipeline{compressor, std::move(io), limits};
+    bool          listOk = true;
+    uint64_t      collisions = 0;
+
+    // 替换扩展名后同一目录下不同的输入可能得到同一个输出（a.jpg 与 a.png 都变成 a.webp），后写的会覆盖先写的。
+    // 撞名时保留原扩展名（a.png.webp），仍然撞名就报错跳过；同一个输入出现多次时只处理一次。
+    // 撞名只发生在同一输出目录的文件之间，遍历是深度优先的，只为当前输出目录及其上级目录记录用过的文件名，
+    // 离开一个目录就丢掉它的记录，内存占用与目录深度和单个目录的文件数有关，与文件总数无关
+    struct OutputDir
+    {
+        fs::path::string_type                                            key;
+        std::unordered_map<fs::path::string_type, fs::path::string_type> used; // 输出路径 -> 占用它的输入
+    };
+    std::vector<OutputDir> openDirs;
+    fs::path::string_type  outputKey = pathKey(options.outputDir);
+    auto                   emit = [&](BatchItem &&item) {
+        auto format = options.format;
+        if (format == Compressor::Params::_count)
+            format = CommandLine::parseFormat(item.input.extension().string());
+        if (format == Compressor::Params::_count)
+            format = Compressor::Params::JPEG;
+
+        BatchPipeline::Item job{.input = std::move(item.input), .output = options.outputDir / item.relative, .param = options.param};
+        job.output.replace_extension(Compressor::formatEnumToString(format));
+        job.param.format = format;
+
+        fs::path::string_type dirKey = pathKey(job.output.parent_path());
+        while (!openDirs.empty() && !isWithin(dirKey, openDirs.back().key))
+            openDirs.pop_back();
+        if (openDirs.empty() || openDirs.back().key != dirKey)
+            openDirs.push_back({std::move(dirKey), {}});
+        auto &used = openDirs.back().used;
+
+        fs::path::string_type inputKey = pathKey(job.input);
+        auto [slot, inserted] = used.try_emplace(pathKey(job.output), inputKey);
+        if (!inserted)
+        {
+            if (slot->second == inputKey)
+                return;
+            fs::path fallback = options.outputDir / item.relative;
+            fallback += Compressor::formatEnumToString(format);
+            auto [fallbackSlot, fallbackInserted] = used.try_emplace(pathKey(fallback), inputKey);
+            if (!fallbackInserted)
+            {
+                if (fallbackSlot->second == inputKey)
+                    return;
+                std::cerr << "Error: Output path already used by another input, skipping: " << job.input.string() << '\n';
+                ++collisions;
+                return;
+            }
+            std::cerr << "Warning: " << job.output.string() << " is already used by another input, writing " << fallback.string() << " instead\n";
+            job.output = std::move(fallback);
+        }
+        pipeline.submit(std::move(job));
+    };
+    // 重复给出的参数只展开一次，重复的文件在同一输出目录内由上面的记录去重
+    std::unordered_set<fs::path::string_type> arguments;
+    for (const std::string &input : cmd.positional)
+    {
+        if (arguments.insert(pathKey(input)).second)
+            expandInput(input, true, outputKey, emit);
+    }
+    if (fileList && !readFileList(*fileList, cmd.option("null") ? '\0' : '\n', outputKey, emit))
+    {
+        std::cerr << "Error: Cannot open file list: " << *fileList << '\n';
+        listOk = false;
+    }
+
+    BatchPipeline::Stats stats = pipeline.finish();
+    std::cout << stats.succeeded << " images compressed, " << stats.failed + collisions << " failed\n";
+    return stats.failed == 0 && collisions == 0 && listOk ? EXIT_SUCCESS : EXIT_FAILURE;
+}
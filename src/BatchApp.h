@@ -0,0 +1,9 @@
+#pragma once
+
+// 批量模式：目录（递归）、通配符与文件列表里的图片共用一个 Compressor 并行压缩，
+// 结果按输入的相对路径写到输出目录下，形成镜像的目录树
+class BatchApp
+{
+public:
+    static int start(int argc, char *argv[]);
+};
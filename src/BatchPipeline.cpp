@@ -0,0 +1,166 @@
+#include "BatchPipeline.h"
+#include "ImageLoader.h"
+
+namespace
+{
+    void leave(std::atomic<uint64_t> &inFlight)
+    {
+        if (inFlight.fetch_sub(1) == 1)
+            inFlight.notify_all();
+    }
+
+    void waitIdle(std::atomic<uint64_t> &inFlight)
+    {
+        for (uint64_t count = inFlight.load(); count != 0; count = inFlight.load())
+            inFlight.wait(count);
+    }
+} // namespace
+
+BatchPipeline::BatchPipeline(Compressor &compressor, std::unique_ptr<AsyncFileIO> io, const Limits &limits) :
+    mCompressor(compressor),
+    mIo(std::move(io)),
+    mReadQueue(std::max(limits.queueDepth, 1u)),
+    mDecodeQueue(std::max(limits.readDepth, 1u)),
+    mReadSlots(std::max(limits.readDepth, 1u)),
+    mWriteSlots(std::max(limits.writeDepth, 1u)),
+    mDecodedSlots(std::max(limits.maxDecoded, 1u))
+{
+    // 读缓冲区留存在 I/O 后端里，不在 Compressor 的管辖范围内，内存压力大时一并释放
+    this->mIo->setReadBufferPoolSize(std::max(limits.readDepth, 1u));
+    this->mCompressor.setMemoryPressureCallback([this] { this->mIo->trimBuffers(); });
+    this->mFeeder = std::jthread(&BatchPipeline::feederThreadFunc, this);
+    for (uint32_t i = 0; i < std::max(limits.decodeThreads, 1u); ++i)
+        this->mDecoders.emplace_back(&BatchPipeline::decoderThreadFunc, this);
+}
+
+BatchPipeline::~BatchPipeline()
+{
+    this->finish();
+    this->mCompressor.setMemoryPressureCallback(nullptr);
+}
+
+void BatchPipeline::submit(Item item)
+{
+    this->mReadQueue.push(std::move(item));
+}
+
+BatchPipeline::Stats BatchPipeline::finish()
+{
+    if (!this->mFinished)
+    {
+        this->mFinished = true;
+
+        // 按阶段顺序关闭，上游都结束后下游不会再有新的工作
+        this->mReadQueue.close();
+        this->mFeeder = {};
+        waitIdle(this->mReading);
+        this->mDecodeQueue.close();
+        this->mDecoders.clear();
+        waitIdle(this->mCompressing);
+        waitIdle(this->mWriting);
+    }
+    return {this->mSucceeded.load(), this->mFailed.load()};
+}
+
+void BatchPipeline::feederThreadFunc()
+{
+    while (std::optional<Item> item = this->mReadQueue.pop())
+    {
+        std::error_code ec;
+        if (std::filesystem::equivalent(item->input, item->output, ec))
+        {
+            std::cerr << "Error: Output would overwrite the input: " << item->input.string() << '\n';
+            ++this->mFailed;
+            continue;
+        }
+
+        // 读完等待解码的文件也占着名额，解码跟不上时读取随之停下
+        this->mReadSlots.acquire();
+        ++this->mReading;
+        std::filesystem::path input = item->input;
+        this->mIo->read(std::move(input), [this, item = std::move(*item)](bool ok, AsyncFileIO::Buffer &&buffer) mutable {
+            if (ok)
+            {
+                this->mDecodeQueue.push({std::move(item), std::move(buffer)});
+            }
+            else
+            {
+                std::cerr << "Error: Cannot read file: " << item.input.string() << '\n';
+                ++this->mFailed;
+                this->mReadSlots.release();
+            }
+            leave(this->mReading);
+        });
+    }
+}
+
+void BatchPipeline::decoderThreadFunc()
+{
+    while (std::optional<ReadResult> job = this->mDecodeQueue.pop())
+    {
+        this->mDecodedSlots.acquire();
+
+        // JPEG 在解码时就缩小，剩下的比例交给 Compressor
+        Item   &item = job->item;
+        int     reduction = 1;
+        cv::Mat image = ImageLoader::decode(job->buffer.data(), job->buffer.size(), item.param.scale, item.param.toGray, reduction);
+        job->buffer = {};
+        this->mReadSlots.release();
+        if (image.empty())
+        {
+            std::cerr << "Error: Cannot decode file: " << item.input.string() << '\n';
+            this->mDecodedSlots.release();
+            ++this->mFailed;
+            continue;
+        }
+
+        Compressor::Params param = item.param;
+        param.scale *= reduction;
+        ++this->mCompressing;
+        auto onFinished = [this, input = item.input, output = item.output](Compressor::TaskHandle, std::vector<uchar> &&result) {
+            this->mDecodedSlots.release();
+            if (result.empty())
+            {
+                std::cerr << "Error: Failed to compress image: " << input.string() << '\n';
+                ++this->mFailed;
+            }
+            else
+            {
+                this->writeOutput(output, std::move(result));
+            }
+            leave(this->mCompressing);
+        };
+        if (this->mCompressor.addCompressionTask(image, param, std::move(onFinished)) == Compressor::InalidHandle)
+        {
+            this->mDecodedSlots.release();
+            ++this->mFailed;
+            leave(this->mCompressing);
+        }
+    }
+}
+
+void BatchPipeline::writeOutput(const std::filesystem::path &output, std::vector<uchar> &&bytes)
+{
+    // 写入跟不上时压缩线程在这里等待，压缩随之放慢
+    this->mWriteSlots.acquire();
+    this->ensureDirectory(output.parent_path());
+    ++this->mWriting;
+    this->mIo->write(output, std::move(bytes), [this, output](bool ok, std::vector<uchar> &&bytes) {
+        if (!ok)
+            std::cerr << "Error: Failed to save image to: " << output.string() << '\n';
+        this->mCompressor.recycleBuffer(std::move(bytes));
+        ++(ok ? this->mSucceeded : this->mFailed);
+        this->mWriteSlots.release();
+        leave(this->mWriting);
+    });
+}
+
+void BatchPipeline::ensureDirectory(const std::filesystem::path &dir)
+{
+    std::unique_lock lock{this->mDirMutex};
+    if (this->mCreatedDirs.insert(dir.native()).second)
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(dir, ec);
+    }
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "AsyncFileIO.h"
+#include "BoundedQueue.h"
+#include "Compressor.h"
+#include <filesystem>
+#include <semaphore>
+#include <thread>
+#include <unordered_set>
+
+// 批量压缩的流水线：读取 → 解码 → 缩放、转灰度与编码 → 写出
+// 读写交给 AsyncFileIO（io_uring 或 I/O 线程池），解码在解码线程上，缩放与编码在 Compressor 的线程池里，
+// 磁盘与 CPU 可以同时忙碌；下游跟不上时上游随之阻塞。
+// 在途的读取、写入与同时驻留的解码后图像数各自限制，与编码的并行度无关
+class BatchPipeline
+{
+public:
+    struct Item
+    {
+        std::filesystem::path input;
+        std::filesystem::path output;
+        Compressor::Params    param; // scale 为相对原图的比例，解码时缩小了多少由流水线自己换算
+    };
+
+    struct Limits
+    {
+        uint32_t readDepth = 32;  // 正在读取和读完等待解码的文件数上限
+        uint32_t writeDepth = 32; // 正在写入的文件数上限
+        uint32_t decodeThreads = 1;
+        uint32_t maxDecoded = 2;  // 解码完成、还没压缩完的图像数上限
+        uint32_t queueDepth = 16; // 等待读取的队列容量
+    };
+
+    struct Stats
+    {
+        uint64_t succeeded = 0;
+        uint64_t failed = 0;
+    };
+
+    // 压缩阶段使用 compressor 的线程池，它的线程数就是编码的并行度。
+    // io 的在途请求数上限至少应为 readDepth + writeDepth
+    BatchPipeline(Compressor &compressor, std::unique_ptr<AsyncFileIO> io, const Limits &limits);
+    ~BatchPipeline();
+
+    BatchPipeline(const BatchPipeline &) = delete;
+    BatchPipeline &operator=(const BatchPipeline &) = delete;
+
+    // 等待读取的队列满时阻塞
+    void submit(Item item);
+
+    // 不再提交，等所有文件都写完后返回统计；只能调用一次
+    Stats finish();
+
+private:
+    struct ReadResult
+    {
+        Item                item;
+        AsyncFileIO::Buffer buffer;
+    };
+
+    void feederThreadFunc();
+    void decoderThreadFunc();
+
+    // 在压缩回调里调用，写入名额用完时阻塞
+    void writeOutput(const std::filesystem::path &output, std::vector<uchar> &&bytes);
+    void ensureDirectory(const std::filesystem::path &dir);
+
+    Compressor                  &mCompressor;
+    std::unique_ptr<AsyncFileIO> mIo;
+
+    BoundedQueue<Item>        mReadQueue;
+    BoundedQueue<ReadResult>  mDecodeQueue;  // 容量等于 readDepth，读取回调往里放时不会阻塞
+    std::counting_semaphore<> mReadSlots;    // 发起读取前取得，解码完成后归还
+    std::counting_semaphore<> mWriteSlots;   // 发起写入前取得，写完后归还
+    std::counting_semaphore<> mDecodedSlots; // 解码前取得，压缩完成后归还
+
+    std::mutex                                             mDirMutex;
+    std::unordered_set<std::filesystem::path::string_type> mCreatedDirs; // 已创建过的输出目录
+
+    // 各阶段在途的数量，finish 按阶段顺序等它们归零
+    std::atomic<uint64_t> mReading = 0;
+    std::atomic<uint64_t> mCompressing = 0;
+    std::atomic<uint64_t> mWriting = 0;
+    std::atomic<uint64_t> mSucceeded = 0;
+    std::atomic<uint64_t> mFailed = 0;
+
+    std::jthread              mFeeder;
+    std::vector<std::jthread> mDecoders;
+    bool                      mFinished = false;
+};
@@ -0,0 +1,181 @@
+#include "Benchmark.h"
+#include "Compressor.h"
+#include "PooledMatAllocator.h"
+#include <chrono>
+#include <latch>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace
+{
+    // 大量 32x32 小图的吞吐量，主要衡量任务提交与调度的开销
+    void benchTinyImageThroughput(uint32_t taskCount)
+    {
+        std::vector<cv::Mat> images(64);
+        for (auto &&image : images)
+        {
+            image.create(32, 32, CV_8UC3);
+            cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(255));
+        }
+
+        std::cout << "32x32 JPEG, " << taskCount << " tasks\n"
+                  << "threads\ttasks/s\n";
+        uint32_t maxThread = WorkerPool::defaultThreadCount();
+        for (uint32_t threads = 1;; threads = std::min(threads * 2, maxThread))
+        {
+            // 同样的 64 张图反复提交，开着编码结果缓存时第一轮之后全是命中，量的就不是调度了
+            Compressor compressor{threads};
+            compressor.setStageCacheBudget(0);
+            compressor.setOutputCacheBudget(0);
+            std::latch done{taskCount};
+
+            auto begin = std::chrono::steady_clock::now();
+            for (uint32_t i = 0; i < taskCount; ++i)
+            {
+                compressor.addCompressionTask(images[i % images.size()], {.quality = 75}, [&done](Compressor::TaskHandle, std::vector<uchar> &&) {
+                    done.count_down();
+                });
+            }
+            done.wait();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+
+            std::cout << threads << '\t' << static_cast<uint64_t>(taskCount / elapsed.count()) << '\n';
+            if (threads == maxThread)
+                break;
+        }
+    }
+
+    // 进程累计的缺页次数
+    uint64_t pageFaults()
+    {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS counters{};
+        GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+        return counters.PageFaultCount;
+#else
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        return static_cast<uint64_t>(usage.ru_minflt + usage.ru_majflt);
+#endif
+    }
+
+    // 大图缩放、转灰度再编码，对比复用像素内存与输出缓冲区前后每个任务的缺页次数。
+    // 关闭中间结果与编码结果缓存，保证每个任务都完整地走一遍
+    void benchLargeImageAllocation(uint32_t taskCount)
+    {
+        cv::Mat image(2000, 3000, CV_8UC3);
+        cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(255));
+        const Compressor::Params param{.scale = 0.5, .quality = 75, .toGray = true};
+
+        std::cout << "\n3000x2000 -> 0.5x gray JPEG, " << taskCount << " tasks\n"
+                  << "pooling\ttasks/s\tfaults/task\n";
+        for (bool pooling : {false, true})
+        {
+            PooledMatAllocator::instance().setBudget(pooling ? PooledMatAllocator::DefaultBudget : 0);
+            Compressor compressor;
+            compressor.setStageCacheBudget(0);
+            compressor.setOutputCacheBudget(0);
+            compressor.setOutputBufferPoolSize(pooling ? Compressor::DefaultOutputBufferPoolSize : 0);
+
+            auto run = [&](uint32_t count) {
+                std::latch done{count};
+                for (uint32_t i = 0; i < count; ++i)
+                {
+                    compressor.addCompressionTask(image, param, [&](Compressor::TaskHandle, std::vector<uchar> &&result) {
+                        compressor.recycleBuffer(std::move(result));
+                        done.count_down();
+                    });
+                }
+                done.wait();
+            };
+            // 先跑几个任务创建好线程、填满池子，只测稳定状态
+            run(compressor.maxThread() * 2);
+
+            uint64_t faults = pageFaults();
+            auto     begin = std::chrono::steady_clock::now();
+            run(taskCount);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+            faults = pageFaults() - faults;
+
+            std::cout << (pooling ? "on" : "off") << '\t' << static_cast<uint64_t>(taskCount / elapsed.count()) << '\t'
+                      << static_cast<double>(faults) / taskCount << '\n';
+        }
+        PooledMatAllocator::instance().setBudget(PooledMatAllocator::DefaultBudget);
+    }
+
+    // 大图解码与缩放在普通页、透明大页、hugetlbfs 大页下的吞吐量。
+    // 像素内存预算设为 0，每次分配都是新映射的内存，衡量的是首次访问的缺页与 TLB 开销
+    void benchHugePages(uint32_t taskCount)
+    {
+        cv::Mat image(4000, 6000, CV_8UC3);
+        cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(255));
+        std::vector<uchar> encoded;
+        cv::imencode(".jpg", image, encoded, {cv::IMWRITE_JPEG_QUALITY, 90});
+        const Compressor::Params param{.scale = 0.75, .quality = 75};
+
+        std::cout << "\n6000x4000 decode, -> 0.75x JPEG, " << taskCount << " tasks\n"
+                  << "pages\tdecode/s\ttasks/s\tfaults/task\n";
+        auto &allocator = PooledMatAllocator::instance();
+        allocator.setBudget(0);
+        for (auto mode : {PooledMatAllocator::HugePages::Off, PooledMatAllocator::HugePages::Transparent, PooledMatAllocator::HugePages::HugeTlb})
+        {
+            const char *name = mode == PooledMatAllocator::HugePages::Off ? "4K" : mode == PooledMatAllocator::HugePages::Transparent ? "thp" : "hugetlb";
+            if (!allocator.setHugePages(mode))
+            {
+                std::cout << name << "\tunsupported\n";
+                continue;
+            }
+
+            uint64_t faults = pageFaults();
+            auto     begin = std::chrono::steady_clock::now();
+            for (uint32_t i = 0; i < taskCount; ++i)
+            {
+                cv::Mat decoded = PooledMatAllocator::makeMat();
+                cv::imdecode(encoded, cv::IMREAD_UNCHANGED, &decoded);
+            }
+            std::chrono::duration<double> decodeElapsed = std::chrono::steady_clock::now() - begin;
+
+            Compressor compressor;
+            compressor.setStageCacheBudget(0);
+            compressor.setOutputCacheBudget(0);
+            std::latch done{taskCount};
+            begin = std::chrono::steady_clock::now();
+            for (uint32_t i = 0; i < taskCount; ++i)
+            {
+                compressor.addCompressionTask(image, param, [&](Compressor::TaskHandle, std::vector<uchar> &&) {
+                    done.count_down();
+                });
+            }
+            done.wait();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+            faults = pageFaults() - faults;
+
+            std::cout << name << '\t' << taskCount / decodeElapsed.count() << '\t' << taskCount / elapsed.count() << '\t'
+                      << static_cast<double>(faults) / taskCount << '\n';
+        }
+        allocator.setHugePages(PooledMatAllocator::HugePages::Off);
+        allocator.setBudget(PooledMatAllocator::DefaultBudget);
+    }
+} // namespace
+
+int Benchmark::start(int argc, char *argv[])
+{
+    uint32_t taskCount = argc >= 3 ? std::stoul(argv[2]) : 20000;
+    if (taskCount == 0)
+    {
+        std::cerr << "Usage: " << argv[0] << " --benchmark [task_count]\n";
+        return EXIT_FAILURE;
+    }
+
+    benchTinyImageThroughput(taskCount);
+    benchLargeImageAllocation(std::max(taskCount / 200, 16u));
+    benchHugePages(std::max(taskCount / 1000, 8u));
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+class Benchmark
+{
+public:
+    static int start(int argc, char *argv[]);
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+// 有容量上限的多生产者多消费者队列。队列满时 push 阻塞，空时 pop 阻塞；
+// close 之后 push 失败，pop 取完剩余元素后返回空
+template <typename T>
+class BoundedQueue
+{
+public:
+    BoundedQueue(std::size_t capacity) :
+        mCapacity(capacity)
+    {
+    }
+
+    bool push(T value)
+    {
+        std::unique_lock lock{this->mMutex};
+        this->mNotFull.wait(lock, [this] { return this->mClosed || this->mItems.size() < this->mCapacity; });
+        if (this->mClosed)
+            return false;
+        this->mItems.push_back(std::move(value));
+        lock.unlock();
+        this->mNotEmpty.notify_one();
+        return true;
+    }
+
+    std::optional<T> pop()
+    {
+        std::unique_lock lock{this->mMutex};
+        this->mNotEmpty.wait(lock, [this] { return this->mClosed || !this->mItems.empty(); });
+        if (this->mItems.empty())
+            return std::nullopt;
+        T value = std::move(this->mItems.front());
+        this->mItems.pop_front();
+        lock.unlock();
+        this->mNotFull.notify_one();
+        return value;
+    }
+
+    void close()
+    {
+        {
+            std::unique_lock lock{this->mMutex};
+            this->mClosed = true;
+        }
+        this->mNotFull.notify_all();
+        this->mNotEmpty.notify_all();
+    }
+
+private:
+    std::mutex              mMutex;
+    std::condition_variable mNotFull;
+    std::condition_variable mNotEmpty;
+    std::deque<T>           mItems;
+    const std::size_t       mCapacity;
+    bool                    mClosed = false;
+};
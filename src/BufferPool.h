@@ -0,0 +1,74 @@
+#pragma once
+
+#include <limits>
+#include <mutex>
+#include <vector>
+
+// 可复用的字节缓冲区，交回的缓冲区清空后保留容量，下次取出时写入不必重新分配。
+// 超过数量上限、容量上限，或留存总容量会超出总量上限的缓冲区直接释放
+class BufferPool
+{
+public:
+    using Buffer = std::vector<unsigned char>;
+
+    BufferPool(std::size_t maxBuffers, std::size_t maxCapacity, std::size_t maxTotalBytes = std::numeric_limits<std::size_t>::max()) :
+        mMaxBuffers(maxBuffers),
+        mMaxCapacity(maxCapacity),
+        mMaxTotalBytes(maxTotalBytes)
+    {
+    }
+
+    Buffer acquire()
+    {
+        std::unique_lock lock{this->mMutex};
+        if (this->mBuffers.empty())
+            return {};
+        Buffer buffer = std::move(this->mBuffers.back());
+        this->mBuffers.pop_back();
+        this->mTotalBytes -= buffer.capacity();
+        return buffer;
+    }
+
+    void release(Buffer &&buffer)
+    {
+        if (buffer.capacity() == 0 || buffer.capacity() > this->mMaxCapacity)
+            return;
+        buffer.clear();
+        std::unique_lock lock{this->mMutex};
+        if (this->mBuffers.size() < this->mMaxBuffers && this->mTotalBytes + buffer.capacity() <= this->mMaxTotalBytes)
+        {
+            this->mTotalBytes += buffer.capacity();
+            this->mBuffers.push_back(std::move(buffer));
+        }
+    }
+
+    // 释放所有留存的缓冲区，内存压力大时调用
+    void clear()
+    {
+        std::vector<Buffer> buffers;
+        {
+            std::unique_lock lock{this->mMutex};
+            buffers.swap(this->mBuffers);
+            this->mTotalBytes = 0;
+        }
+    }
+
+    void setMaxBuffers(std::size_t maxBuffers)
+    {
+        std::unique_lock lock{this->mMutex};
+        this->mMaxBuffers = maxBuffers;
+        while (this->mBuffers.size() > maxBuffers)
+        {
+            this->mTotalBytes -= this->mBuffers.back().capacity();
+            this->mBuffers.pop_back();
+        }
+    }
+
+private:
+    std::mutex          mMutex;
+    std::vector<Buffer> mBuffers;
+    std::size_t         mMaxBuffers;
+    const std::size_t   mMaxCapacity;
+    const std::size_t   mMaxTotalBytes;
+    std::size_t         mTotalBytes = 0; // 留存的缓冲区容量之和
+};
@@ -0,0 +1,175 @@
+#include "CommandLine.h"
+#include "PooledMatAllocator.h"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <utility>
+
+namespace
+{
+    // 取值也可以写成下一个参数的选项（--format webp）；其余选项的取值只能用 = 连接，
+    // 像 --huge-pages 这样取值可省略的选项不能吞掉后面的位置参数
+    constexpr std::string_view SeparateValueOptions[] = {
+        "quality", "scale", "format", "target-size", "target-ssim", "target-psnr", "threads", "output-dir", "files-from", "memory",
+    };
+
+    // 短选项及其对应的长选项，短选项总是带取值：-q 75
+    constexpr std::pair<char, std::string_view> ShortOptions[] = {
+        {'q', "quality"},
+        {'f', "format"},
+    };
+
+    bool takesSeparateValue(std::string_view name)
+    {
+        return std::ranges::find(SeparateValueOptions, name) != std::end(SeparateValueOptions);
+    }
+
+    const std::string_view *longOptionFor(std::string_view arg)
+    {
+        if (arg.size() != 2 || arg[0] != '-')
+            return nullptr;
+        auto iter = std::ranges::find(ShortOptions, arg[1], &std::pair<char, std::string_view>::first);
+        return iter == std::end(ShortOptions) ? nullptr : &iter->second;
+    }
+} // namespace
+
+CommandLine::CommandLine(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string_view arg = argv[i];
+        if (const std::string_view *name = longOptionFor(arg))
+        {
+            // 缺少取值时记为空串，由各选项自己的解析报错
+            this->options.emplace(*name, i + 1 < argc ? argv[++i] : "");
+            continue;
+        }
+        if (!arg.starts_with("--"))
+        {
+            this->positional.emplace_back(arg);
+            continue;
+        }
+        std::size_t eq = arg.find('=');
+        if (eq != std::string_view::npos)
+            this->options.emplace(arg.substr(2, eq - 2), arg.substr(eq + 1));
+        else if (takesSeparateValue(arg.substr(2)) && i + 1 < argc)
+            this->options.emplace(arg.substr(2), argv[++i]);
+        else
+            this->options.emplace(arg.substr(2), "");
+    }
+}
+
+const std::string *CommandLine::option(const std::string &name) const
+{
+    auto iter = this->options.find(name);
+    return iter == this->options.end() ? nullptr : &iter->second;
+}
+
+bool CommandLine::parseCompressOptions(Compressor::Params &param, uint32_t &threads) const
+{
+    if (const std::string *value = this->option("target-size"))
+    {
+        param.targetSize = CommandLine::parseByteSize(*value);
+        if (param.targetSize == 0)
+            return false;
+    }
+    if (const std::string *value = this->option("target-ssim"))
+    {
+        param.targetSsim = CommandLine::parsePositive(*value);
+        if (param.targetSsim == 0.0 || param.targetSsim > 1.0)
+            return false;
+    }
+    if (const std::string *value = this->option("target-psnr"))
+    {
+        param.targetPsnr = CommandLine::parsePositive(*value);
+        if (param.targetPsnr == 0.0)
+            return false;
+    }
+
+    threads = WorkerPool::defaultThreadCount();
+    if (const std::string *value = this->option("threads"))
+    {
+        // 按整数解析，2.7、0.5 这样的小数整体拒绝，不截断
+        auto [end, ec] = std::from_chars(value->data(), value->data() + value->size(), threads);
+        if (ec != std::errc{} || end != value->data() + value->size() || threads == 0)
+            return false;
+    }
+
+    if (const std::string *value = this->option("huge-pages"))
+    {
+        auto mode = PooledMatAllocator::HugePages::Transparent;
+        if (*value == "hugetlb")
+            mode = PooledMatAllocator::HugePages::HugeTlb;
+        else if (!value->empty() && *value != "thp")
+            return false;
+        if (!PooledMatAllocator::instance().setHugePages(mode))
+            std::cerr << "Warning: huge pages are not supported on this platform\n";
+    }
+    return true;
+}
+
+const char *CommandLine::compressOptionsUsage()
+{
+    return "  --target-size=<size>: Find the highest quality whose output fits in <size> bytes (e.g. 200K, 1.5M)\n"
+           "  --target-ssim=<ssim>: Find the lowest quality whose output reaches <ssim> (0-1, e.g. 0.95)\n"
+           "  --target-psnr=<dB>: Find the lowest quality whose output reaches <dB> PSNR (e.g. 40)\n"
+           "  --threads=<n>: Worker thread count (default: CPU quota/affinity, or the IMG_THREADS environment variable)\n"
+           "  --huge-pages[=thp|hugetlb]: Back pixel buffers of large images with 2MB pages (default: thp)\n";
+}
+
+std::size_t CommandLine::parseByteSize(const std::string &text)
+{
+    try
+    {
+        std::size_t end = 0;
+        double      value = std::stod(text, &end);
+        std::string suffix = text.substr(end);
+        if (suffix == "K" || suffix == "k" || suffix == "KB" || suffix == "KiB")
+            value *= 1024;
+        else if (suffix == "M" || suffix == "m" || suffix == "MB" || suffix == "MiB")
+            value *= 1024 * 1024;
+        else if (suffix == "G" || suffix == "g" || suffix == "GB" || suffix == "GiB")
+            value *= 1024 * 1024 * 1024;
+        else if (!suffix.empty() && suffix != "B")
+            return 0;
+        return value > 0 ? static_cast<std::size_t>(value) : 0;
+    } catch (const std::exception &)
+    {
+        return 0;
+    }
+}
+
+bool CommandLine::parseQuality(const std::string &text, int &quality)
+{
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), quality);
+    return ec == std::errc{} && end == text.data() + text.size() && quality >= 0 && quality <= 100;
+}
+
+double CommandLine::parsePositive(const std::string &text)
+{
+    try
+    {
+        std::size_t end = 0;
+        double      value = std::stod(text, &end);
+        return end == text.size() && value > 0 ? value : 0.0;
+    } catch (const std::exception &)
+    {
+        return 0.0;
+    }
+}
+
+Compressor::Params::Format CommandLine::parseFormat(std::string_view extension)
+{
+    std::string lower{extension};
+    for (char &c : lower)
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+
+    if (lower == ".jpg" || lower == ".jpeg")
+        return Compressor::Params::JPEG;
+    else if (lower == ".png")
+        return Compressor::Params::PNG;
+    else if (lower == ".webp")
+        return Compressor::Params::WEBP;
+    else
+        return Compressor::Params::_count;
+}
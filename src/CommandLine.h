@@ -0,0 +1,37 @@
+#pragma once
+
+#include "Compressor.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// 命令行：--name=value 或 --name 形式的选项，其余按顺序作为位置参数。
+// --quality、--format 等必带取值的选项也可写作 --name value，-q、-f 是 --quality、--format 的简写
+struct CommandLine
+{
+    std::vector<std::string>                     positional;
+    std::unordered_map<std::string, std::string> options;
+
+    CommandLine(int argc, char *argv[]);
+
+    const std::string *option(const std::string &name) const;
+
+    // 单文件与批量模式共用的选项：--target-size、--target-ssim、--target-psnr、--threads、--huge-pages。
+    // 结果写入 param 与 threads，有取值不合法的选项时返回 false
+    bool parseCompressOptions(Compressor::Params &param, uint32_t &threads) const;
+
+    // 上述选项的用法说明
+    static const char *compressOptionsUsage();
+
+    // 解析 "200K"、"1.5M"、"300000" 这样的字节数，失败返回 0
+    static std::size_t parseByteSize(const std::string &text);
+
+    // 解析 0-100 的整数质量，失败返回 false
+    static bool parseQuality(const std::string &text, int &quality);
+
+    // 解析正数，失败返回 0
+    static double parsePositive(const std::string &text);
+
+    // 扩展名（含点，不区分大小写）对应的输出格式，不支持时返回 _count
+    static Compressor::Params::Format parseFormat(std::string_view extension);
+};
@@ -1,150 +1,804 @@
 #include "Compressor.h"
+#include "ImageMetrics.h"
+#include "PoolParallelBackend.h"
+#include "PooledMatAllocator.h"
+#include <bit>
+#include <cstring>
+#include <utility>
 
 using namespace std::chrono_literals;
 
+namespace
+{
+    // 每个线程各自的临时图像与编码参数，只在一次调用内使用；尺寸不变时 create 直接复用已有内存
+    thread_local cv::Mat          tl_previewScratch = PooledMatAllocator::makeMat();
+    thread_local cv::Mat          tl_previewGrayScratch = PooledMatAllocator::makeMat();
+    thread_local cv::Mat          tl_decodeScratch = PooledMatAllocator::makeMat();
+    thread_local std::vector<int> tl_encodeParams;
+} // namespace
+
 Compressor::Compressor(uint32_t maxThread) :
-    mMaxThread(maxThread)
+    mPool(maxThread)
 {
-    this->mCompressWorkers.reserve(this->mMaxThread);
+    // OpenCV 内部的并行也在这个线程池上执行，缩放、编码等调用不会再额外占用线程
+    PoolParallelBackend::attach(this->mPool);
 }
 
 Compressor::~Compressor()
 {
-    std::unique_lock lock{this->mMutex};
-    this->mThreadDestroy = true;
-    this->mCondi.notify_all();
+    this->mPressureMonitor.reset();
+    PoolParallelBackend::detach(this->mPool);
 }
 
 Compressor::TaskHandle Compressor::addCompressionTask(const cv::Mat &image, const Params &param)
 {
-    TaskHandle ret;
+    return this->addCompressionTask(image, param, nullptr, TaskOptions{});
+}
+
+Compressor::TaskHandle Compressor::addCompressionTask(const cv::Mat &image, const Params &param, CompletionCallback callback)
+{
+    return this->addCompressionTask(image, param, std::move(callback), TaskOptions{});
+}
+
+Compressor::TaskHandle Compressor::addCompressionTask(const cv::Mat &image, const Params &param, CompletionCallback callback, const TaskOptions &options)
+{
+    auto task = std::make_shared<Task>();
+    task->mRawImage = image;
+    task->mCompressionParam = param;
+    task->mCallback = std::move(callback);
+    task->mPriority = options.priority;
+    if (options.previewCallback && options.previewMaxSide > 0)
     {
-        std::unique_lock lock{this->mMutex};
-        this->mQueuedTasks.emplace(this->mGenId, image, std::vector<uchar>{}, param);
-        ret = this->mGenId++;
-        if (this->mIdleThread == 0 && this->mCompressWorkers.size() < this->mMaxThread)
-            this->mCompressWorkers.emplace_back([this]() {
-                this->compressThreadFunc();
-            });
+        task->mPreviewMaxSide = options.previewMaxSide;
+        task->mPreviewCallback = options.previewCallback;
     }
-    this->mCondi.notify_one();
-    return ret;
+
+    // 先顶替同一来源的旧任务，命中缓存的新任务也一样，否则旧任务的回调会在新结果之后到达并把它覆盖。
+    // 顶替在申请内存之前，被顶替的任务还在排队时其占用立即归还
+    if (options.sourceKey != 0)
+    {
+        std::unique_lock lock{this->mTaskTableMutex};
+        this->supersedeSource(options.sourceKey);
+    }
+
+    std::optional<std::vector<uchar>> cachedOutput;
+    if (this->mOutputCache.budget() != 0)
+    {
+        task->mContentHash = options.contentHash != 0 ? options.contentHash : Compressor::hashImage(image);
+        cachedOutput = this->mOutputCache.get(OutputKey::of(image, task->mContentHash, param));
+        ++(cachedOutput ? this->mOutputCacheHits : this->mOutputCacheMisses);
+    }
+
+    // 命中缓存的任务不持有原图
+    if (!cachedOutput)
+    {
+        task->mRawBytes = image.total() * image.elemSize();
+        if (!this->reserveMemory(task->mRawBytes))
+            return InalidHandle;
+    }
+
+    {
+        std::unique_lock lock{this->mTaskTableMutex};
+        // 上面解锁期间同一来源可能又提交了任务
+        if (options.sourceKey != 0)
+            this->supersedeSource(options.sourceKey);
+        task->mId = this->allocSlot();
+        TaskSlot &slot = this->mTaskSlots[static_cast<uint32_t>(task->mId)];
+        if (!cachedOutput)
+        {
+            slot.mTask = task;
+            slot.mSourceKey = options.sourceKey;
+            if (options.sourceKey != 0)
+                this->mLatestTaskBySource[options.sourceKey] = task->mId;
+        }
+        else if (task->mCallback)
+        {
+            this->freeSlot(task->mId);
+        }
+        else
+        {
+            slot.mOutputImage = std::move(*cachedOutput);
+            slot.mState = SlotState::Finished;
+            this->chargeResult(slot);
+        }
+    }
+
+    // 命中缓存，不经过工作线程直接完成
+    if (cachedOutput)
+    {
+        if (task->mCallback)
+            task->mCallback(task->mId, std::move(*cachedOutput));
+        return task->mId;
+    }
+
+    this->submitTask(task, options.priority);
+    return task->mId;
+}
+
+std::future<std::vector<uchar>> Compressor::addCompressionTaskAsync(const cv::Mat &image, const Params &param, TaskHandle *outHandle)
+{
+    return this->addCompressionTaskAsync(image, param, TaskOptions{}, outHandle);
+}
+
+std::future<std::vector<uchar>> Compressor::addCompressionTaskAsync(const cv::Mat &image, const Params &param, const TaskOptions &options, TaskHandle *outHandle)
+{
+    // std::function 要求可复制，promise 只能放在 shared_ptr 里
+    auto                            promise = std::make_shared<std::promise<std::vector<uchar>>>();
+    std::future<std::vector<uchar>> future = promise->get_future();
+
+    auto onFinished = [promise](TaskHandle, std::vector<uchar> &&result) {
+        promise->set_value(std::move(result));
+    };
+    TaskHandle handle = this->addCompressionTask(image, param, onFinished, options);
+    if (outHandle)
+        *outHandle = handle;
+    return future;
 }
+
 bool Compressor::checkTaskFinished(Compressor::TaskHandle handle)
 {
-    std::unique_lock lock{this->mFinishedTaskMutex};
+    std::unique_lock lock{this->mTaskTableMutex};
 
-    auto iter = std::find_if(this->mFinishedTasks.begin(),
-                             this->mFinishedTasks.end(),
-                             [handle](const Compressor::Task &task) {
-                                 return task.mId == handle;
-                             });
-    return iter != this->mFinishedTasks.end();
+    TaskSlot *slot = this->findSlot(handle);
+    return slot && slot->mState == SlotState::Finished;
 }
 
 void Compressor::removeTask(Compressor::TaskHandle handle)
 {
-    if (handle == Compressor::InalidHandle)
+    std::unique_lock lock{this->mTaskTableMutex};
+
+    TaskSlot *slot = this->findSlot(handle);
+    if (!slot)
         return;
-    std::unique_lock lock{this->mFinishedTaskMutex};
-    std::size_t      erased = std::erase_if(this->mFinishedTasks, [handle](const Compressor::Task &task) { return task.mId == handle; });
-    if (erased == 0)
-        this->mPendingRemoveTasks.emplace_back(handle);
-    return;
+    if (slot->mState == SlotState::Finished)
+        this->freeSlot(handle);
+    else
+        this->cancelTask(handle, *slot);
 }
 
-std::vector<uchar> Compressor::getCompressResult(Compressor::TaskHandle handle)
+void Compressor::setTaskPriority(Compressor::TaskHandle handle, Priority priority)
+{
+    std::unique_lock lock{this->mTaskTableMutex};
+
+    TaskSlot *slot = this->findSlot(handle);
+    if (!slot || slot->mState != SlotState::Pending)
+        return;
+    Task &task = *slot->mTask;
+    if (task.mPriority == priority || task.mStatus.load() != Status::Idle)
+        return;
+
+    // 无锁队列里的任务没法挪动，按新优先级再提交一次；代数加一后，旧优先级队列里的那一项被取到时直接丢弃，
+    // 降级的任务不会再从高优先级队列里被先取到
+    task.mPriority = priority;
+    ++task.mQueueGeneration;
+    this->submitTask(slot->mTask, priority);
+}
+
+void Compressor::setStageCacheBudget(std::size_t bytes)
+{
+    this->mStageCache.setBudget(bytes);
+}
+
+void Compressor::evictSource(const cv::Mat &image)
+{
+    this->mStageCache.eraseIf([&image](const StageKey &key, const StageEntry &) {
+        return key.mSource == image.data;
+    });
+}
+
+void Compressor::setOutputCacheBudget(std::size_t bytes)
+{
+    this->mOutputCache.setBudget(bytes);
+}
+
+Compressor::CacheStats Compressor::getOutputCacheStats() const
 {
-    std::unique_lock lock{this->mFinishedTaskMutex};
+    return {this->mOutputCacheHits.load(), this->mOutputCacheMisses.load(), this->mOutputCache.bytes()};
+}
 
-    auto iter = std::find_if(this->mFinishedTasks.begin(),
-                             this->mFinishedTasks.end(),
-                             [handle](const Compressor::Task &task) {
-                                 return task.mId == handle;
-                             });
-    if (iter != this->mFinishedTasks.end())
+void Compressor::setMemoryBudget(std::size_t bytes, Backpressure policy, std::chrono::milliseconds timeout)
+{
     {
-        std::vector<uchar> ret = std::move(iter->mOutputImage);
-        this->mFinishedTasks.erase(iter);
-        return ret;
+        std::unique_lock lock{this->mMemoryMutex};
+        this->mMemory.budget = bytes;
+        this->mBackpressure = policy;
+        this->mBackpressureTimeout = timeout;
     }
-    else
+    this->mMemoryCondi.notify_all();
+}
+
+bool Compressor::setMemoryPressureMonitor(bool enabled)
+{
+    if (!enabled)
     {
-        return {};
+        this->mPressureMonitor.reset();
+        this->mPool.setConcurrencyCap(0);
+        return true;
+    }
+    if (!this->mPressureMonitor)
+    {
+        this->mPressureMonitor = MemoryPressureMonitor::start([this](double stallPercent) {
+            this->onMemoryPressure(stallPercent);
+        });
     }
+    return this->mPressureMonitor != nullptr;
+}
+
+void Compressor::setMemoryPressureCallback(std::function<void()> callback)
+{
+    std::unique_lock lock{this->mPressureCallbackMutex};
+    this->mPressureCallback = std::move(callback);
 }
 
-void Compressor::compressThreadFunc()
+// avg10 是 10 秒的滑动平均，减半后要过一阵才会回落：压力还在上升，或距上次减半已过一个窗口，才再次减半
+void Compressor::onMemoryPressure(double stallPercent)
 {
-#if _POSIX_THREADS
-    pthread_setname_np(pthread_self(), "Compressing Thread");
-#endif
-    std::unique_lock lock{this->mMutex};
-    while (true)
+    auto     now = std::chrono::steady_clock::now();
+    uint32_t cap = this->mPool.concurrencyCap();
+    if (stallPercent >= PressureHigh)
     {
-        if (this->mQueuedTasks.empty())
+        if (stallPercent > this->mLastStall || now - this->mLastThrottle >= 10s)
         {
-            ++mIdleThread;
-            this->mCondi.wait(lock);
-            --mIdleThread;
-            if (this->mThreadDestroy)
-                break;
-            if (this->mQueuedTasks.empty())
-                continue;
+            this->mPool.setConcurrencyCap(std::max(cap / 2, 1u));
+            // 留存待复用的内存都还给系统，压力过去后再按需重新分配
+            this->mStageCache.clear();
+            this->mOutputBuffers.clear();
+            PooledMatAllocator::instance().trim();
+            {
+                std::unique_lock lock{this->mPressureCallbackMutex};
+                if (this->mPressureCallback)
+                    this->mPressureCallback();
+            }
+            this->mLastThrottle = now;
         }
+    }
+    else if (stallPercent <= PressureLow && cap < this->mPool.maxThread())
+    {
+        this->mPool.setConcurrencyCap(cap + 1);
+    }
+    this->mLastStall = stallPercent;
+}
+
+Compressor::MemoryStats Compressor::getMemoryStats() const
+{
+    std::unique_lock lock{this->mMemoryMutex};
+    return this->mMemory;
+}
+
+bool Compressor::reserveMemory(std::size_t rawBytes)
+{
+    std::unique_lock lock{this->mMemoryMutex};
+    auto             fits = [this, rawBytes]() {
+        std::size_t used = this->mMemory.rawBytes + this->mMemory.resultBytes;
+        return this->mMemory.budget == 0 || used == 0 || used + rawBytes <= this->mMemory.budget;
+    };
+    switch (this->mBackpressure)
+    {
+    case Backpressure::Block:
+        this->mMemoryCondi.wait(lock, fits);
+        break;
+    case Backpressure::Timeout:
+        if (!this->mMemoryCondi.wait_for(lock, this->mBackpressureTimeout, fits))
+            return false;
+        break;
+    case Backpressure::Reject:
+        if (!fits())
+            return false;
+        break;
+    }
+    this->mMemory.rawBytes += rawBytes;
+    return true;
+}
+
+void Compressor::releaseMemory(std::size_t rawBytes, std::size_t resultBytes)
+{
+    if (rawBytes == 0 && resultBytes == 0)
+        return;
+    {
+        std::unique_lock lock{this->mMemoryMutex};
+        this->mMemory.rawBytes -= rawBytes;
+        this->mMemory.resultBytes -= resultBytes;
+    }
+    this->mMemoryCondi.notify_all();
+}
+
+// 结果已经生成，只记账不等待
+void Compressor::chargeResult(TaskSlot &slot)
+{
+    slot.mResultBytes = slot.mOutputImage.size();
+    std::unique_lock lock{this->mMemoryMutex};
+    this->mMemory.resultBytes += slot.mResultBytes;
+}
 
-        Task task = std::move(this->mQueuedTasks.front());
-        this->mQueuedTasks.pop();
+void Compressor::recycleBuffer(std::vector<uchar> &&buffer)
+{
+    this->mOutputBuffers.release(std::move(buffer));
+}
+
+void Compressor::setOutputBufferPoolSize(std::size_t count)
+{
+    this->mOutputBuffers.setMaxBuffers(count);
+}
+
+void Compressor::setIdleWorkerTimeout(std::chrono::milliseconds timeout)
+{
+    this->mPool.setIdleTimeout(timeout);
+}
+
+void Compressor::setMinWarmWorkers(uint32_t count)
+{
+    this->mPool.setMinThread(count);
+}
+
+void Compressor::setAdaptiveConcurrency(bool enabled)
+{
+    this->mPool.setAdaptiveConcurrency(enabled);
+}
+
+// 4 路并行的乘法-异或哈希，按行处理以支持不连续的 ROI，只用于缓存查找，不追求抗碰撞
+uint64_t Compressor::hashImage(const cv::Mat &image)
+{
+    constexpr uint64_t prime1 = 0x9e3779b97f4a7c15ull;
+    constexpr uint64_t prime2 = 0xc2b2ae3d27d4eb4full;
 
-        lock.unlock();
-        Compressor::compressImage(task);
+    uint64_t    lanes[4] = {prime1, prime2, ~prime1, ~prime2};
+    std::size_t rowBytes = image.cols * image.elemSize();
+    int         rows = image.rows;
+    if (image.isContinuous())
+    {
+        rowBytes *= rows;
+        rows = rows > 0 ? 1 : 0;
+    }
+
+    for (int y = 0; y < rows; ++y)
+    {
+        const uchar *p = image.ptr(y);
+        std::size_t  n = rowBytes;
+        for (; n >= 32; n -= 32, p += 32)
         {
-            std::unique_lock lock2{this->mFinishedTaskMutex};
-            if (std::erase_if(this->mPendingRemoveTasks, [&task](TaskHandle id) { return task.mId == id; }) == 0)
+            for (int i = 0; i < 4; ++i)
             {
-                this->mFinishedTasks.emplace_back(std::move(task));
+                uint64_t word;
+                std::memcpy(&word, p + i * 8, 8);
+                lanes[i] = std::rotl(lanes[i] ^ word * prime2, 31) * prime1;
             }
         }
-        lock.lock();
+        for (; n > 0; --n, ++p)
+            lanes[0] = std::rotl(lanes[0] ^ *p * prime2, 11) * prime1;
     }
+
+    uint64_t hash = lanes[0] ^ std::rotl(lanes[1], 17) ^ std::rotl(lanes[2], 29) ^ std::rotl(lanes[3], 43);
+    hash ^= static_cast<uint64_t>(image.rows) << 32 | static_cast<uint32_t>(image.cols);
+    // splitmix64 收尾，打散各位
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+    return hash ^ (hash >> 31);
+}
+
+std::vector<uchar> Compressor::getCompressResult(Compressor::TaskHandle handle)
+{
+    std::unique_lock lock{this->mTaskTableMutex};
+
+    TaskSlot *slot = this->findSlot(handle);
+    if (!slot || slot->mState != SlotState::Finished)
+        return {};
+
+    std::vector<uchar> ret = std::move(slot->mOutputImage);
+    this->freeSlot(handle);
+    return ret;
+}
+
+Compressor::TaskHandle Compressor::allocSlot()
+{
+    uint32_t index;
+    if (this->mFreeSlots.empty())
+    {
+        index = static_cast<uint32_t>(this->mTaskSlots.size());
+        this->mTaskSlots.emplace_back();
+    }
+    else
+    {
+        index = this->mFreeSlots.back();
+        this->mFreeSlots.pop_back();
+    }
+    TaskSlot &slot = this->mTaskSlots[index];
+    slot.mState = SlotState::Pending;
+    slot.mRemoved = false;
+    return static_cast<TaskHandle>(slot.mGeneration) << 32 | index;
+}
+
+void Compressor::cancelTask(TaskHandle handle, TaskSlot &slot)
+{
+    Task  &task = *slot.mTask;
+    Status expected = Status::Idle;
+    if (task.mStatus.compare_exchange_strong(expected, Status::TaskCancelled))
+    {
+        // 还在队列里：工作线程取到后会直接丢弃，这里立即释放图像和回调
+        task.mRawImage.release();
+        task.mCallback = nullptr;
+        task.mPreviewCallback = nullptr;
+        this->releaseMemory(std::exchange(task.mRawBytes, 0), 0);
+        this->freeSlot(handle);
+    }
+    else
+    {
+        task.mCancelled = true;
+        slot.mRemoved = true;
+        this->forgetSourceKey(handle, slot);
+    }
+}
+
+void Compressor::supersedeSource(uint64_t sourceKey)
+{
+    auto iter = this->mLatestTaskBySource.find(sourceKey);
+    if (iter != this->mLatestTaskBySource.end())
+        this->cancelTask(iter->second, *this->findSlot(iter->second));
+}
+
+void Compressor::forgetSourceKey(TaskHandle handle, TaskSlot &slot)
+{
+    if (slot.mSourceKey == 0)
+        return;
+    auto iter = this->mLatestTaskBySource.find(slot.mSourceKey);
+    if (iter != this->mLatestTaskBySource.end() && iter->second == handle)
+        this->mLatestTaskBySource.erase(iter);
+    slot.mSourceKey = 0;
+}
+
+Compressor::TaskSlot *Compressor::findSlot(TaskHandle handle)
+{
+    uint32_t index = static_cast<uint32_t>(handle);
+    uint32_t generation = static_cast<uint32_t>(handle >> 32);
+    if (index >= this->mTaskSlots.size())
+        return nullptr;
+    TaskSlot &slot = this->mTaskSlots[index];
+    if (slot.mGeneration != generation || slot.mState == SlotState::Free)
+        return nullptr;
+    return &slot;
+}
+
+void Compressor::freeSlot(TaskHandle handle)
+{
+    uint32_t  index = static_cast<uint32_t>(handle);
+    TaskSlot &slot = this->mTaskSlots[index];
+    this->forgetSourceKey(handle, slot);
+    this->releaseMemory(0, std::exchange(slot.mResultBytes, 0));
+    slot.mState = SlotState::Free;
+    slot.mTask.reset();
+    slot.mOutputImage = {};
+    // 跳过 0 和 0xFFFFFFFF，保证回绕后也不会与 InalidHandle 或已失效的旧句柄混淆
+    if (++slot.mGeneration == std::numeric_limits<uint32_t>::max())
+        slot.mGeneration = 1;
+    this->mFreeSlots.push_back(index);
+}
+
+Compressor::StageKey Compressor::StageKey::of(const cv::Mat &source, double scale, bool toGray)
+{
+    return {source.data, source.rows, source.cols, source.type(), source.step[0], scale, toGray};
+}
+
+std::size_t Compressor::StageKey::Hash::operator()(const StageKey &key) const
+{
+    std::size_t hash = std::hash<const uchar *>{}(key.mSource);
+    for (std::size_t value : {std::size_t(key.mRows), std::size_t(key.mCols), std::size_t(key.mType), key.mStep,
+                              std::hash<double>{}(key.mScale), std::size_t(key.mToGray)})
+        hash ^= value + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+    return hash;
+}
+
+Compressor::OutputKey Compressor::OutputKey::of(const cv::Mat &source, uint64_t contentHash, const Params &param)
+{
+    return {contentHash, source.rows, source.cols, source.type(), param};
+}
+
+std::size_t Compressor::OutputKey::Hash::operator()(const OutputKey &key) const
+{
+    std::size_t hash = key.mContentHash;
+    for (std::size_t value : {std::size_t(key.mRows), std::size_t(key.mCols), std::size_t(key.mType), std::hash<double>{}(key.mParams.scale),
+                              std::size_t(key.mParams.quality), std::size_t(key.mParams.toGray), std::size_t(key.mParams.format),
+                              key.mParams.targetSize, std::hash<double>{}(key.mParams.targetSsim), std::hash<double>{}(key.mParams.targetPsnr)})
+        hash ^= value + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+    return hash;
+}
+
+void Compressor::cacheStage(const cv::Mat &source, double scale, bool toGray, const cv::Mat &result)
+{
+    std::size_t bytes = source.total() * source.elemSize() + result.total() * result.elemSize();
+    this->mStageCache.put(StageKey::of(source, scale, toGray), {source, result}, bytes);
+}
+
+void Compressor::submitTask(const std::shared_ptr<Task> &task, Priority priority)
+{
+    uint32_t generation = task->mQueueGeneration.load();
+    this->mPool.submit([this, task, generation]() { this->runTask(task, generation); }, priority);
+}
+
+void Compressor::runTask(const std::shared_ptr<Task> &taskPtr, uint32_t generation)
+{
+    Task &task = *taskPtr;
+    if (task.mQueueGeneration.load() != generation)
+        return; // 改过优先级，以新优先级重新入队的那一项为准
+
+    Status expected = Status::Idle;
+    if (!task.mStatus.compare_exchange_strong(expected, Status::TaskStarted))
+        return; // 排队期间已被取消
+
+    if (task.mPreviewCallback)
+        this->encodePreview(task);
+
+    OutputKey outputKey = OutputKey::of(task.mRawImage, task.mContentHash, task.mCompressionParam);
+    if (!this->compressImage(task))
+        task.mOutputImage.clear();
+    else if (task.mContentHash != 0)
+        this->mOutputCache.put(outputKey, task.mOutputImage, task.mOutputImage.size());
+    task.mRawImage.release();
+    this->releaseMemory(std::exchange(task.mRawBytes, 0), 0);
+    task.mStatus = task.mCancelled ? Status::TaskCancelled : Status::TaskEnded;
+    bool removed;
+    {
+        std::unique_lock lock{this->mTaskTableMutex};
+        TaskSlot        *slot = this->findSlot(task.mId);
+        removed = slot->mRemoved;
+        if (removed || task.mCallback)
+        {
+            this->freeSlot(task.mId);
+        }
+        else
+        {
+            this->forgetSourceKey(task.mId, *slot);
+            slot->mOutputImage = std::move(task.mOutputImage);
+            slot->mState = SlotState::Finished;
+            this->chargeResult(*slot);
+        }
+    }
+    // 回调在锁外执行，避免回调里再调用 Compressor 时死锁
+    if (!removed && task.mCallback)
+        task.mCallback(task.mId, std::move(task.mOutputImage));
+}
+
+// 直接从原图缩到预览尺寸，一次缩放比先做全尺寸缩放再缩小快得多，大图上预览能在全尺寸结果之前很久就出来
+void Compressor::encodePreview(Task &task)
+{
+    const Params &param = task.mCompressionParam;
+    double        scale = param.scale > 0.0 && param.scale < 1.0 ? param.scale : 1.0;
+    int           longSide = std::max(task.mRawImage.cols, task.mRawImage.rows);
+    if (longSide * scale <= task.mPreviewMaxSide)
+        return;
+
+    double previewScale = static_cast<double>(task.mPreviewMaxSide) / longSide;
+    cv::resize(task.mRawImage, tl_previewScratch, cv::Size(), previewScale, previewScale, cv::INTER_AREA);
+    const cv::Mat *preview = &tl_previewScratch;
+    if (param.toGray && tl_previewScratch.channels() > 1)
+    {
+        cv::cvtColor(tl_previewScratch, tl_previewGrayScratch, cv::COLOR_BGR2GRAY);
+        preview = &tl_previewGrayScratch;
+    }
+
+    std::vector<uchar> output = this->mOutputBuffers.acquire();
+    if (task.mCancelled.load(std::memory_order_relaxed) || !Compressor::encodeImage(*preview, param.format, param.quality, output))
+    {
+        this->mOutputBuffers.release(std::move(output));
+        return;
+    }
+    if (!task.mCancelled.load(std::memory_order_relaxed))
+        task.mPreviewCallback(task.mId, std::move(output));
+    else
+        this->mOutputBuffers.release(std::move(output));
 }
 
 // 图片压缩处理
 bool Compressor::compressImage(Task &task)
 {
+    const Params &param = task.mCompressionParam;
+    bool          needResize = param.scale > 0.0 && param.scale < 1.0;
+    double        scale = needResize ? param.scale : 1.0;
+    cv::Mat       source = task.mRawImage;
+
+    // 先找转灰度后的缓存，没有再找只缩放过的缓存。缓存的图像是共享的，后面的步骤不能原地修改
+    bool resized = !needResize, grayed = !param.toGray || source.channels() == 1;
+    if (!grayed)
+    {
+        if (auto cached = this->mStageCache.get(StageKey::of(source, scale, true)))
+        {
+            task.mRawImage = cached->mResult;
+            resized = grayed = true;
+        }
+    }
+    if (!resized)
+    {
+        if (auto cached = this->mStageCache.get(StageKey::of(source, scale, false)))
+        {
+            task.mRawImage = cached->mResult;
+            resized = true;
+        }
+    }
+
+    Priority priority = task.mPriority.load(std::memory_order_relaxed);
+
     // 调整尺寸
-    if (task.mCompressionParam.scale > 0.0 && task.mCompressionParam.scale < 1.0)
+    if (!resized)
     {
-        cv::resize(task.mRawImage, task.mRawImage, cv::Size(), task.mCompressionParam.scale, task.mCompressionParam.scale, cv::INTER_LINEAR);
+        task.mRawImage = this->resizeImage(task.mRawImage, scale);
+        this->cacheStage(source, scale, false, task.mRawImage);
     }
+    if (task.mCancelled.load(std::memory_order_relaxed))
+        return false;
 
     // 转换为灰度图
-    if (task.mCompressionParam.toGray)
+    if (!grayed)
     {
-        cv::cvtColor(task.mRawImage, task.mRawImage, cv::COLOR_BGR2GRAY);
+        task.mRawImage = this->toGrayImage(task.mRawImage, priority);
+        this->cacheStage(source, scale, true, task.mRawImage);
     }
+    if (task.mCancelled.load(std::memory_order_relaxed))
+        return false;
+
+    if (param.targetSize != 0 || param.targetSsim > 0.0 || param.targetPsnr > 0.0)
+        return this->searchQuality(task);
+    task.mOutputImage = this->mOutputBuffers.acquire();
+    return Compressor::encodeImage(task.mRawImage, param.format, param.quality, task.mOutputImage);
+}
+
+// 缩放不分带：子区域会改变 resize 的取样网格，用 warpAffine 拼接又与 resize 的结果有细微差别，
+// 同样的输入会因线程池忙闲得到不同的输出并被写进缓存。大图的 resize 已经通过 PoolParallelBackend 在线程池上并行
+cv::Mat Compressor::resizeImage(const cv::Mat &image, double scale)
+{
+    cv::Mat resizedImage = PooledMatAllocator::makeMat();
+    cv::resize(image, resizedImage, cv::Size(), scale, scale, cv::INTER_LINEAR);
+    return resizedImage;
+}
+
+cv::Mat Compressor::toGrayImage(const cv::Mat &image, Priority priority)
+{
+    cv::Mat grayImage = PooledMatAllocator::makeMat();
+    if (image.total() < ParallelStageMinPixels || this->mPool.spareThreads() == 0)
+    {
+        cv::cvtColor(image, grayImage, cv::COLOR_BGR2GRAY);
+        return grayImage;
+    }
+
+    grayImage.create(image.size(), CV_MAKETYPE(image.depth(), 1));
+    this->forEachRowBand(image.rows, priority, [&](int begin, int end) {
+        cv::Mat band = grayImage.rowRange(begin, end);
+        cv::cvtColor(image.rowRange(begin, end), band, cv::COLOR_BGR2GRAY);
+    });
+    return grayImage;
+}
 
+// 只按线程池的空闲线程分带：其他线程都在处理别的图像时由当前线程独自做完，线程花在多张图像之间；
+// 行数太少时减少带数，避免调度开销超过计算本身
+void Compressor::forEachRowBand(int rows, Priority priority, const std::function<void(int begin, int end)> &body)
+{
+    uint32_t bands = std::clamp<uint32_t>(static_cast<uint32_t>(rows / MinRowsPerBand), 1u, this->mPool.spareThreads() + 1);
+    if (bands == 1)
+    {
+        body(0, rows);
+        return;
+    }
+    this->mPool.parallelFor(bands, [&](uint32_t i) {
+        body(static_cast<int>(rows * static_cast<uint64_t>(i) / bands), static_cast<int>(rows * static_cast<uint64_t>(i + 1) / bands));
+    }, priority);
+}
+
+// 按目标搜索质量，两种目标都假定随质量单调：
+//  - targetSize：编码后不超过 targetSize 的最高质量，都超出时取质量最低的结果
+//  - targetSsim / targetPsnr：解码后与输入相比达标的最低质量，都不达标时取质量最高的结果
+// 把质量映射到"越往后越难满足"的步数上，两种目标就都是找最后一个满足的步数。
+// 每轮在剩余区间内均匀取若干步，在空闲的工作线程上并行试编码，缩放后的图像在各次试编码间共享
+bool Compressor::searchQuality(Task &task)
+{
+    const Params  &param = task.mCompressionParam;
+    const bool     bySize = param.targetSize != 0;
+    const int      maxQuality = std::clamp(param.quality, 0, 100);
+    const uint32_t probeCount = std::clamp(this->mPool.maxThread(), 1u, SearchMaxProbes);
+
+    auto qualityOf = [&](int step) {
+        return bySize ? step : maxQuality - step;
+    };
+
+    // 感知质量的参考图只转换一次
+    cv::Mat reference = bySize ? cv::Mat{} : ImageMetrics::toGray8U(task.mRawImage);
+    auto    accept = [&](const std::vector<uchar> &output) {
+        if (bySize)
+            return output.size() <= param.targetSize;
+        cv::Mat decoded;
+        try
+        {
+            decoded = cv::imdecode(output, cv::IMREAD_UNCHANGED, &tl_decodeScratch);
+        } catch (const cv::Exception &e)
+        {
+            std::cerr << "OpenCV Error: " << e.what() << '\n';
+            return false;
+        }
+        if (param.targetSsim > 0.0 && ImageMetrics::ssim(reference, decoded) < param.targetSsim)
+            return false;
+        if (param.targetPsnr > 0.0 && ImageMetrics::psnr(reference, decoded) < param.targetPsnr)
+            return false;
+        return true;
+    };
+
+    int                lo = 0, hi = maxQuality;
+    bool               found = false;
+    std::vector<uchar> best, fallback;
+    int                fallbackStep = std::numeric_limits<int>::max();
+    while (lo <= hi)
+    {
+        if (task.mCancelled.load(std::memory_order_relaxed))
+            return false;
+
+        std::vector<int> steps;
+        for (uint32_t i = 1; i <= probeCount; ++i)
+        {
+            int step = lo + (hi - lo) * static_cast<int>(i) / static_cast<int>(probeCount);
+            if (steps.empty() || steps.back() != step)
+                steps.push_back(step);
+        }
+
+        std::vector<std::vector<uchar>> outputs(steps.size());
+        std::vector<char>               succeeded(steps.size()), accepted(steps.size());
+        auto                            probe = [&](uint32_t i) {
+            outputs[i] = this->mOutputBuffers.acquire();
+            succeeded[i] = Compressor::encodeImage(task.mRawImage, param.format, qualityOf(steps[i]), outputs[i]);
+            accepted[i] = succeeded[i] && accept(outputs[i]);
+        };
+        this->mPool.parallelFor(static_cast<uint32_t>(steps.size()), probe, task.mPriority.load(std::memory_order_relaxed));
+
+        int nextLo = lo, nextHi = hi;
+        for (std::size_t i = 0; i < steps.size(); ++i)
+        {
+            if (!succeeded[i])
+                return false;
+            if (accepted[i])
+            {
+                this->mOutputBuffers.release(std::move(best));
+                best = std::move(outputs[i]);
+                found = true;
+                nextLo = steps[i] + 1;
+            }
+            else
+            {
+                if (steps[i] < fallbackStep)
+                {
+                    this->mOutputBuffers.release(std::move(fallback));
+                    fallback = std::move(outputs[i]);
+                    fallbackStep = steps[i];
+                }
+                nextHi = steps[i] - 1;
+                break;
+            }
+        }
+        lo = nextLo;
+        hi = nextHi;
+        // 没被选中的试编码结果
+        for (auto &&output : outputs)
+            this->mOutputBuffers.release(std::move(output));
+    }
+
+    task.mOutputImage = found ? std::move(best) : std::move(fallback);
+    this->mOutputBuffers.release(std::move(found ? fallback : best));
+    return true;
+}
+
+bool Compressor::encodeImage(const cv::Mat &image, Params::Format format, int quality, std::vector<uchar> &out)
+{
     try
     {
-        std::vector<int> compression_params;
-        switch (task.mCompressionParam.format)
+        std::vector<int> &compression_params = tl_encodeParams;
+        switch (format)
         {
         case Params::JPEG:
-            compression_params = {cv::IMWRITE_JPEG_QUALITY, task.mCompressionParam.quality};
+            compression_params.assign({cv::IMWRITE_JPEG_QUALITY, quality});
             break;
         case Params::PNG:
-            compression_params = {cv::IMWRITE_PNG_COMPRESSION, 10 - task.mCompressionParam.quality / 10};
+            compression_params.assign({cv::IMWRITE_PNG_COMPRESSION, 10 - quality / 10});
             break;
         case Params::WEBP:
-            compression_params = {cv::IMWRITE_WEBP_QUALITY, task.mCompressionParam.quality};
+            compression_params.assign({cv::IMWRITE_WEBP_QUALITY, quality});
             break;
         default:
             return false;
         }
-        return cv::imencode(formatEnumToString(task.mCompressionParam.format).data(),
-                            task.mRawImage,
-                            task.mOutputImage,
-                            compression_params);
+        return cv::imencode(formatEnumToString(format).data(), image, out, compression_params);
     } catch (const cv::Exception &e)
     {
         std::cerr << "OpenCV Error: " << e.what() << '\n';
@@ -1,8 +1,15 @@
 #pragma once
 
+#include "BufferPool.h"
+#include "LruCache.h"
+#include "MemoryPressureMonitor.h"
+#include "WorkerPool.h"
 #include <opencv2/opencv.hpp>
 #include <thread>
 #include <variant>
+#include <future>
+#include <functional>
+#include <unordered_map>
 #include <condition_variable>
 
 class Compressor
@@ -21,14 +28,23 @@ public:
             _count
         } format = JPEG; // 输出格式
 
+        // 目标文件大小（字节），不为 0 时在 [0, quality] 内搜索编码后不超过该大小的最高质量
+        std::size_t targetSize = 0;
+
+        // 目标感知质量，大于 0 时在 [0, quality] 内搜索解码结果与（缩放后的）输入相比达标的最低质量，即最小的文件。
+        // 与 targetSize 同时设置时以 targetSize 为准
+        double targetSsim = 0.0;
+        double targetPsnr = 0.0; // dB
+
         constexpr bool operator==(const Params &rhs) const
         {
-            return scale == rhs.scale && quality == rhs.quality && toGray == rhs.toGray && format == rhs.format;
+            return scale == rhs.scale && quality == rhs.quality && toGray == rhs.toGray && format == rhs.format
+                && targetSize == rhs.targetSize && targetSsim == rhs.targetSsim && targetPsnr == rhs.targetPsnr;
         }
 
         constexpr bool operator!=(const Params &rhs) const
         {
-            return scale != rhs.scale || quality != rhs.quality || toGray != rhs.toGray || format != rhs.format;
+            return !(*this == rhs);
         }
     };
 
@@ -39,22 +55,134 @@ public:
         TaskStarted,
         TaskEnded,
         WaitingForExit,
-        ThreadExit
+        ThreadExit,
+        TaskCancelled
     };
 
-    using TaskHandle = uint32_t;
+    // 高 32 位为槽位的代数，低 32 位为槽位下标。
+    // 槽位回收时代数加一，旧句柄随之失效；代数不会取到 0 和 0xFFFFFFFF，所以有效句柄不会等于 InalidHandle
+    using TaskHandle = uint64_t;
+
+    static constexpr TaskHandle InalidHandle = std::numeric_limits<TaskHandle>::max();
+
+    // 任务完成后在工作线程上调用，压缩失败时 result 为空
+    using CompletionCallback = std::function<void(TaskHandle handle, std::vector<uchar> &&result)>;
+
+    // 工作线程总是先执行高优先级的任务，低优先级任务按老化规则穿插执行
+    using Priority = WorkerPool::Priority;
 
-    static constexpr uint32_t InalidHandle = std::numeric_limits<uint32_t>::max();
+    struct TaskOptions
+    {
+        // 非 0 时同一来源只保留最新提交的任务：排队中的旧任务直接丢弃，正在压缩的旧任务被中止，
+        // 被顶替的任务与 removeTask 的效果相同。已完成的任务不受影响
+        uint64_t sourceKey = 0;
+
+        Priority priority = Priority::Normal;
+
+        // 图像内容的哈希，0 表示由 addCompressionTask 计算。
+        // 同一张图会反复提交时由调用方算一次 hashImage 传进来，省去每次提交时的哈希
+        uint64_t contentHash = 0;
+
+        // 渐进预览：输出的长边超过 previewMaxSide 时，先把原图缩到该尺寸编码一次交给 previewCallback，
+        // 再压缩全尺寸结果。两次回调的句柄相同，预览总在最终结果之前，任务被取消后不再回调。
+        // 预览直接用 quality 编码，不做目标搜索，也不写入缓存
+        int                previewMaxSide = 0;
+        CompletionCallback previewCallback;
+    };
+
+    // 超出内存预算时新提交的任务如何处理
+    enum class Backpressure : uint8_t
+    {
+        Block = 0, // 阻塞到有足够的任务完成
+        Timeout,   // 至多阻塞一段时间，超时后拒绝
+        Reject     // 立即拒绝
+    };
+
+    struct MemoryStats
+    {
+        std::size_t rawBytes = 0;    // 排队中和处理中任务的原图
+        std::size_t resultBytes = 0; // 留在任务表里等待 getCompressResult 取走的结果
+        std::size_t budget = 0;
+    };
+
+    struct CacheStats
+    {
+        uint64_t    hits = 0;
+        uint64_t    misses = 0;
+        std::size_t bytes = 0;
+    };
 
-    Compressor(uint32_t maxThread = std::thread::hardware_concurrency());
+    Compressor(uint32_t maxThread = WorkerPool::defaultThreadCount());
     ~Compressor();
 
+    uint32_t maxThread() const { return this->mPool.maxThread(); }
+
     TaskHandle addCompressionTask(const cv::Mat &image, const Params &param);
 
+    // 带回调的任务：结果直接交给回调，不会留在任务表里，也无需轮询 checkTaskFinished。
+    // 命中编码结果缓存时回调在提交线程上、addCompressionTask 返回前调用
+    TaskHandle addCompressionTask(const cv::Mat &image, const Params &param, CompletionCallback callback);
+    TaskHandle addCompressionTask(const cv::Mat &image, const Params &param, CompletionCallback callback, const TaskOptions &options);
+
+    // 返回 future 的任务，被 removeTask 移除的任务其 future 以 std::future_errc::broken_promise 结束
+    std::future<std::vector<uchar>> addCompressionTaskAsync(const cv::Mat &image, const Params &param, TaskHandle *outHandle = nullptr);
+    std::future<std::vector<uchar>> addCompressionTaskAsync(const cv::Mat &image, const Params &param, const TaskOptions &options, TaskHandle *outHandle = nullptr);
+
     bool checkTaskFinished(Compressor::TaskHandle handle);
 
+    // 排队中的任务立即丢弃并释放图像引用；正在压缩的任务在下一个处理阶段前中止；不会调用回调
     void removeTask(Compressor::TaskHandle handle);
 
+    // 调整排队中任务的优先级，已开始的任务不受影响
+    void setTaskPriority(Compressor::TaskHandle handle, Priority priority);
+
+    // 缩放、转灰度后的中间结果缓存，同一原图只改质量或格式时直接复用，只需重新编码。
+    // 缓存项持有原图的引用，原图大小也计入预算；预算为 0 时不缓存
+    void setStageCacheBudget(std::size_t bytes);
+
+    // 原图不再使用时调用，释放中间结果缓存对它的引用
+    void evictSource(const cv::Mat &image);
+
+    static constexpr std::size_t DefaultStageCacheBudget = 256ull << 20;
+
+    // 编码结果缓存，以像素内容哈希与压缩参数为键，命中时任务不经过工作线程直接完成；预算为 0 时不缓存也不计算哈希
+    void       setOutputCacheBudget(std::size_t bytes);
+    CacheStats getOutputCacheStats() const;
+
+    static constexpr std::size_t DefaultOutputCacheBudget = 64ull << 20;
+
+    static uint64_t hashImage(const cv::Mat &image);
+
+    // 内存预算，0 表示不限。被拒绝的提交返回 InalidHandle 且不调用回调，异步接口的 future 以 broken_promise 结束。
+    // 单个任务就超出预算时，只要当前没有占用就放行。
+    // 轮询方式的结果要被 getCompressResult 取走才释放预算，用 Block 时提交线程不要同时负责取结果
+    void        setMemoryBudget(std::size_t bytes, Backpressure policy = Backpressure::Block, std::chrono::milliseconds timeout = {});
+    MemoryStats getMemoryStats() const;
+
+    // 用完的结果（回调、future 或 getCompressResult 拿到的）交回复用，之后的编码直接写进它已有的容量，
+    // 省去大块内存的分配与缺页。池大小为 0 时不复用
+    void recycleBuffer(std::vector<uchar> &&buffer);
+    void setOutputBufferPoolSize(std::size_t count);
+
+    static constexpr std::size_t DefaultOutputBufferPoolSize = 32;
+    static constexpr std::size_t MaxPooledBufferCapacity = 64ull << 20;
+
+    // 空闲的工作线程超时后退出，至少保留 count 个；开启自适应并发后按吞吐量增减同时工作的线程数。见 WorkerPool
+    void setIdleWorkerTimeout(std::chrono::milliseconds timeout);
+    void setMinWarmWorkers(uint32_t count);
+    void setAdaptiveConcurrency(bool enabled);
+
+    // 按 Linux PSI 内存压力调节：停顿比例超过 PressureHigh 时同时工作的线程数减半，清空中间结果缓存、
+    // 输出缓冲池与 PooledMatAllocator 留存的像素内存，并调用 setMemoryPressureCallback 设置的回调；
+    // 低于 PressureLow 时每个采样周期恢复一个线程。系统不支持 PSI 时返回 false
+    bool setMemoryPressureMonitor(bool enabled);
+
+    // 内存压力过高时在监控线程上调用，供调用方释放 Compressor 之外留存的内存（如读文件的缓冲区）；传空取消
+    void setMemoryPressureCallback(std::function<void()> callback);
+
+    static constexpr double PressureHigh = 10.0; // some avg10，百分数
+    static constexpr double PressureLow = 2.0;
+
     std::vector<uchar> getCompressResult(Compressor::TaskHandle handle);
 
     static constexpr std::string_view formatEnumToString(Params::Format format)
@@ -87,14 +215,6 @@ public:
     }
 
 private:
-    std::mutex                mMutex;
-    std::condition_variable   mCondi;
-    std::vector<std::jthread> mCompressWorkers;
-    uint32_t                  mMaxThread;
-    uint32_t                  mIdleThread = 0;
-    TaskHandle                mGenId = 0;
-    bool                      mThreadDestroy = false;
-
     struct Task
     {
         TaskHandle mId;
@@ -102,19 +222,146 @@ private:
         cv::Mat            mRawImage;
         std::vector<uchar> mOutputImage;
 
-        Params mCompressionParam;
-        Status mStatus = Status::Uninitailized;
+        Params                mCompressionParam;
+        std::atomic<Priority> mPriority = Priority::Normal; // 只在排队中且持有 mTaskTableMutex 时修改
+        std::atomic<uint32_t> mQueueGeneration = 0;         // 每次改优先级重新入队时加一，只有代数相符的队列项会执行
+        uint64_t              mContentHash = 0;             // 0 表示不写入编码结果缓存
+        std::size_t           mRawBytes = 0;                // 计入内存预算的原图字节数，释放原图时归还
+
+        // Idle（排队中）只能被 CAS 成 TaskStarted 或 TaskCancelled 一次，
+        // 抢到的一方独占 mRawImage 与 mCallback
+        std::atomic<Status> mStatus = Status::Idle;
+        std::atomic<bool>   mCancelled = false; // 运行中被取消，由 compressImage 在各阶段之间检查
+
+        CompletionCallback mCallback;
+
+        int                mPreviewMaxSide = 0;
+        CompletionCallback mPreviewCallback;
+    };
+
+    enum class SlotState : uint8_t
+    {
+        Free = 0,
+        Pending, // 排队中或正在压缩
+        Finished
+    };
+
+    // 任务表的槽位，句柄通过下标 O(1) 定位，再比对代数排除过期句柄
+    struct TaskSlot
+    {
+        uint32_t              mGeneration = 1;
+        SlotState             mState = SlotState::Free;
+        bool                  mRemoved = false; // 运行中被 removeTask，完成后直接回收
+        std::shared_ptr<Task> mTask;            // 未完成时持有，用于取消
+        std::vector<uchar>    mOutputImage;
+        std::size_t           mResultBytes = 0; // 计入内存预算的结果字节数，回收槽位时归还
+        uint64_t              mSourceKey = 0;
+    };
+
+    std::mutex            mTaskTableMutex;
+    std::vector<TaskSlot> mTaskSlots;
+    std::vector<uint32_t> mFreeSlots;
+
+    // 每个来源最新的未完成任务
+    std::unordered_map<uint64_t, TaskHandle> mLatestTaskBySource;
+
+    // 以下函数需持有 mTaskTableMutex
+    TaskHandle allocSlot();
+    TaskSlot  *findSlot(TaskHandle handle);
+    void       freeSlot(TaskHandle handle);
+    void       cancelTask(TaskHandle handle, TaskSlot &slot);
+    void       forgetSourceKey(TaskHandle handle, TaskSlot &slot);
+    void       supersedeSource(uint64_t sourceKey);
+
+    // 中间结果以原图数据地址标识，缓存项持有原图引用，地址在缓存项存在期间不会被复用
+    struct StageKey
+    {
+        const uchar *mSource;
+        int          mRows, mCols, mType;
+        std::size_t  mStep;
+        double       mScale;
+        bool         mToGray;
+
+        bool operator==(const StageKey &rhs) const = default;
+
+        static StageKey of(const cv::Mat &source, double scale, bool toGray);
+
+        struct Hash
+        {
+            std::size_t operator()(const StageKey &key) const;
+        };
+    };
+
+    struct StageEntry
+    {
+        cv::Mat mSource;
+        cv::Mat mResult;
     };
 
-    std::mutex       mTaskMutex;
-    std::queue<Task> mQueuedTasks;
+    LruCache<StageKey, StageEntry, StageKey::Hash> mStageCache{DefaultStageCacheBudget};
+
+    void cacheStage(const cv::Mat &source, double scale, bool toGray, const cv::Mat &result);
+
+    struct OutputKey
+    {
+        uint64_t mContentHash;
+        int      mRows, mCols, mType;
+        Params   mParams;
+
+        bool operator==(const OutputKey &rhs) const = default;
+
+        static OutputKey of(const cv::Mat &source, uint64_t contentHash, const Params &param);
+
+        struct Hash
+        {
+            std::size_t operator()(const OutputKey &key) const;
+        };
+    };
+
+    LruCache<OutputKey, std::vector<uchar>, OutputKey::Hash> mOutputCache{DefaultOutputCacheBudget};
+    std::atomic<uint64_t>                                    mOutputCacheHits = 0;
+    std::atomic<uint64_t>                                    mOutputCacheMisses = 0;
+
+    mutable std::mutex        mMemoryMutex;
+    std::condition_variable   mMemoryCondi;
+    MemoryStats               mMemory;
+    Backpressure              mBackpressure = Backpressure::Block;
+    std::chrono::milliseconds mBackpressureTimeout{0};
+
+    bool reserveMemory(std::size_t rawBytes);
+    void releaseMemory(std::size_t rawBytes, std::size_t resultBytes);
+    void chargeResult(TaskSlot &slot);
+
+    std::unique_ptr<MemoryPressureMonitor> mPressureMonitor;
+    std::mutex                             mPressureCallbackMutex;
+    std::function<void()>                  mPressureCallback;
+    double                                 mLastStall = 0.0; // 只在监控线程上访问
+    std::chrono::steady_clock::time_point  mLastThrottle;    // 只在监控线程上访问
+
+    void onMemoryPressure(double stallPercent);
+
+    BufferPool mOutputBuffers{DefaultOutputBufferPoolSize, MaxPooledBufferCapacity};
+
+    void submitTask(const std::shared_ptr<Task> &task, Priority priority);
+    void runTask(const std::shared_ptr<Task> &task, uint32_t generation);
+
+    void encodePreview(Task &task);
+    bool compressImage(Task &task);
+
+    // 超过 ParallelStageMinPixels 的图像在线程池有空闲线程时按行分带并行转灰度，逐像素的转换分带后结果不变
+    cv::Mat resizeImage(const cv::Mat &image, double scale);
+    cv::Mat toGrayImage(const cv::Mat &image, Priority priority);
+    void    forEachRowBand(int rows, Priority priority, const std::function<void(int begin, int end)> &body);
 
-    std::vector<TaskHandle> mPendingRemoveTasks;
+    static constexpr std::size_t ParallelStageMinPixels = 4ull << 20;
+    static constexpr int         MinRowsPerBand = 64;
+    bool searchQuality(Task &task);
 
-    std::mutex        mFinishedTaskMutex;
-    std::vector<Task> mFinishedTasks;
+    // 按目标搜索质量时每轮并行试编码的质量个数上限
+    static constexpr uint32_t SearchMaxProbes = 4;
 
-    void compressThreadFunc();
+    static bool encodeImage(const cv::Mat &image, Params::Format format, int quality, std::vector<uchar> &out);
 
-    static bool compressImage(Task &task);
+    // 放在最后，析构时最先等待工作线程结束，之后才销毁任务表
+    WorkerPool mPool;
 };
@@ -1,104 +1,332 @@
 #include "ConsoleApp.h"
+#include "BoundedQueue.h"
+#include "CommandLine.h"
 #include "Compressor.h"
+#include "ImageLoader.h"
+#include <climits>
+#include <cstdio>
 #include <filesystem>
+#include <fstream>
+#include <thread>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
 
 namespace
 {
     namespace fs = std::filesystem;
 
-    cv::Mat loadImage(const std::string &input_path)
+    constexpr std::size_t InitialReadSize = 1 << 20;
+    constexpr std::size_t FrameHeaderSize = 4; // 大端序 uint32 长度
+
+    enum class FrameStatus
+    {
+        Ok,
+        End,  // 在帧边界上遇到输入结束
+        Error // 读取失败、帧不完整或长度超出解码上限
+    };
+
+    bool writeFile(const fs::path &path, const std::vector<uchar> &data)
+    {
+        std::ofstream file{path, std::ios::binary | std::ios::trunc};
+        if (!file.write(reinterpret_cast<const char *>(data.data()), data.size()))
+            return false;
+        file.close();
+        return !file.fail();
+    }
+
+    // Windows 上标准输入输出默认是文本模式，会改写换行符并把 0x1A 当作输入结束
+    void setBinaryStdio()
+    {
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    }
+
+    // 读到输入结束，缓冲区每次填满后加倍
+    bool readAll(std::FILE *file, std::vector<uchar> &data)
     {
-        try
+        std::size_t used = 0;
+        data.resize(InitialReadSize);
+        for (;;)
         {
-            cv::Mat image = cv::imread(input_path, cv::IMREAD_UNCHANGED);
-            if (image.empty())
-                return {};
-            return image;
-        } catch (const cv::Exception &e)
+            used += std::fread(data.data() + used, 1, data.size() - used, file);
+            if (used < data.size())
+                break;
+            data.resize(data.size() * 2);
+        }
+        data.resize(used);
+        return !std::ferror(file);
+    }
+
+    FrameStatus readFrame(std::FILE *file, std::vector<uchar> &data)
+    {
+        uchar       header[FrameHeaderSize];
+        std::size_t got = std::fread(header, 1, FrameHeaderSize, file);
+        if (got == 0 && std::feof(file))
+            return FrameStatus::End;
+        if (got != FrameHeaderSize)
+            return FrameStatus::Error;
+
+        uint32_t size = (uint32_t{header[0]} << 24) | (uint32_t{header[1]} << 16) | (uint32_t{header[2]} << 8) | uint32_t{header[3]};
+        // 超出 imdecode 上限的帧无法解码，也不值得先分配再丢弃
+        if (size > INT_MAX)
+            return FrameStatus::Error;
+        data.resize(size);
+        return std::fread(data.data(), 1, size, file) == size ? FrameStatus::Ok : FrameStatus::Error;
+    }
+
+    // 每帧写完就刷新，管道另一端不必等缓冲区攒满就能拿到结果
+    bool writeFrame(std::FILE *file, const std::vector<uchar> &data)
+    {
+        uint32_t size = static_cast<uint32_t>(data.size());
+        uchar    header[FrameHeaderSize] = {static_cast<uchar>(size >> 24), static_cast<uchar>(size >> 16), static_cast<uchar>(size >> 8), static_cast<uchar>(size)};
+        return std::fwrite(header, 1, FrameHeaderSize, file) == FrameHeaderSize && std::fwrite(data.data(), 1, data.size(), file) == data.size()
+            && std::fflush(file) == 0;
+    }
+
+    std::future<std::vector<uchar>> emptyResult()
+    {
+        std::promise<std::vector<uchar>> promise;
+        promise.set_value({});
+        return promise.get_future();
+    }
+
+    void printStreamUsage(const char *program)
+    {
+        std::cerr << "Usage: " << program << " --stdin --format=<jpg|png|webp> [options]\n"
+                  << "  Reads an encoded image from stdin and writes the compressed image to stdout\n"
+                  << "  -q, --quality=<quality>: Compression quality (0-100, default: 80)\n"
+                  << "  --scale=<scale>: Scaling factor (0-1, default: 1.0)\n"
+                  << "  --gray: Convert to grayscale\n"
+                  << "  --framed: Read and write a stream of images, each prefixed with its length as a 4-byte big-endian integer.\n"
+                  << "            Results keep the input order; an image that fails is answered with an empty frame\n"
+                  << CommandLine::compressOptionsUsage();
+    }
+
+    // 单张图：读完标准输入再解码，结果整个写到标准输出
+    int streamSingle(Compressor &compressor, const Compressor::Params &param)
+    {
+        std::vector<uchar> data;
+        if (!readAll(stdin, data))
+        {
+            std::cerr << "Error: Failed to read from stdin\n";
+            return EXIT_FAILURE;
+        }
+
+        int     reduction = 1;
+        cv::Mat image = ImageLoader::decode(data.data(), data.size(), param.scale, param.toGray, reduction);
+        if (image.empty())
+        {
+            std::cerr << "Error: Cannot decode image from stdin\n";
+            return EXIT_FAILURE;
+        }
+        std::vector<uchar>().swap(data);
+
+        Compressor::Params reduced = param;
+        reduced.scale = param.scale * reduction;
+        std::vector<uchar> out = compressor.addCompressionTaskAsync(image, reduced).get();
+        if (out.empty())
+        {
+            std::cerr << "Error: Failed to compress image from stdin\n";
+            return EXIT_FAILURE;
+        }
+        if (param.targetSize != 0 && out.size() > param.targetSize)
+            std::cerr << "Warning: " << out.size() << " bytes even at the lowest quality, larger than the target size\n";
+
+        if (std::fwrite(out.data(), 1, out.size(), stdout) != out.size() || std::fflush(stdout) != 0)
         {
-            std::cerr << "OpenCV Error: " << e.what() << '\n';
-            return {};
+            std::cerr << "Error: Failed to write to stdout\n";
+            return EXIT_FAILURE;
         }
+        return EXIT_SUCCESS;
     }
 
-    static constexpr Compressor::Params::Format stringToFormatEnum(std::string_view format)
+    // 分帧模式：读取线程逐帧解码并提交，写出线程按提交顺序等待结果并写回，
+    // 同时在途的帧数受队列容量限制，输入再快内存也不会无限增长
+    int streamFramed(Compressor &compressor, const Compressor::Params &param)
     {
-        if (format == ".jpg" || format == ".jpeg")
-            return Compressor::Params::JPEG;
-        else if (format == ".png")
-            return Compressor::Params::PNG;
-        else if (format == ".webp")
-            return Compressor::Params::WEBP;
-        else
-            return Compressor::Params::_count;
+        BoundedQueue<std::future<std::vector<uchar>>> pending{compressor.maxThread() * 2};
+        uint64_t                                      failed = 0;
+        bool                                          writeFailed = false;
+
+        std::jthread writer{[&] {
+            while (auto result = pending.pop())
+            {
+                std::vector<uchar> out;
+                try
+                {
+                    out = result->get();
+                } catch (const std::future_error &)
+                {
+                }
+                if (out.empty())
+                    ++failed;
+                // 标准输出关闭后不再写，关闭队列让读取线程停下，剩下的结果取出后直接丢弃
+                if (!writeFailed && !writeFrame(stdout, out))
+                {
+                    writeFailed = true;
+                    pending.close();
+                }
+                compressor.recycleBuffer(std::move(out));
+            }
+        }};
+
+        std::vector<uchar> data;
+        bool               readFailed = false;
+        for (uint64_t index = 0;; ++index)
+        {
+            FrameStatus status = readFrame(stdin, data);
+            if (status != FrameStatus::Ok)
+            {
+                readFailed = status == FrameStatus::Error;
+                if (readFailed)
+                    std::cerr << "Error: Truncated or oversized frame " << index << " on stdin\n";
+                break;
+            }
+
+            int                             reduction = 1;
+            cv::Mat                         image = ImageLoader::decode(data.data(), data.size(), param.scale, param.toGray, reduction);
+            std::future<std::vector<uchar>> result;
+            if (image.empty())
+            {
+                std::cerr << "Error: Cannot decode frame " << index << '\n';
+                result = emptyResult();
+            }
+            else
+            {
+                Compressor::Params reduced = param;
+                reduced.scale = param.scale * reduction;
+                result = compressor.addCompressionTaskAsync(image, reduced);
+            }
+            if (!pending.push(std::move(result)))
+                break;
+        }
+        pending.close();
+        writer.join();
+
+        if (writeFailed)
+            std::cerr << "Error: Failed to write to stdout\n";
+        if (failed != 0)
+            std::cerr << failed << " images failed\n";
+        return readFailed || writeFailed || failed != 0 ? EXIT_FAILURE : EXIT_SUCCESS;
     }
 
+    int startStream(const CommandLine &cmd, const char *program)
+    {
+        Compressor::Params param;
+        uint32_t           threads = 0;
+        bool               ok = cmd.parseCompressOptions(param, threads);
+
+        // 输入没有文件名可供推断，输出格式必须显式给出
+        const std::string *format = cmd.option("format");
+        ok = ok && format && cmd.positional.empty();
+        if (format)
+        {
+            param.format = CommandLine::parseFormat("." + *format);
+            ok = ok && param.format != Compressor::Params::_count;
+        }
+        if (const std::string *value = cmd.option("quality"))
+            ok = ok && CommandLine::parseQuality(*value, param.quality);
+        if (const std::string *value = cmd.option("scale"))
+        {
+            param.scale = CommandLine::parsePositive(*value);
+            ok = ok && param.scale > 0.0 && param.scale <= 1.0;
+        }
+        param.toGray = cmd.option("gray") != nullptr;
+        if (!ok)
+        {
+            printStreamUsage(program);
+            return EXIT_FAILURE;
+        }
+
+        setBinaryStdio();
+
+        // 每张图只压缩一次，关掉两级缓存，也省去每张图的哈希
+        Compressor compressor{threads};
+        compressor.setStageCacheBudget(0);
+        compressor.setOutputCacheBudget(0);
+        return cmd.option("framed") ? streamFramed(compressor, param) : streamSingle(compressor, param);
+    }
 } // namespace
 
 int ConsoleApp::start(int argc, char *argv[])
 {
-    if (argc < 4 || argc > 6)
+    CommandLine cmd{argc, argv};
+    if (cmd.option("stdin"))
+        return startStream(cmd, argv[0]);
+
+    Compressor::Params param;
+    uint32_t           threads = 0;
+    bool               optionsOk = cmd.parseCompressOptions(param, threads);
+    if (cmd.positional.size() < 3 || cmd.positional.size() > 5 || !optionsOk)
     {
         std::cerr << "Usage: " << argv[0]
-                  << " <input_path> <output_path> <quality> [scale] [to_gray]\n"
-                  << "  <quality>: Compression quality (0-100)\n"
+                  << " <input_path> <output_path> <quality> [scale] [to_gray] [options]\n"
+                  << "  <quality>: Compression quality (0-100), the upper bound when --target-size is given\n"
                   << "  [scale]: Scaling factor (default: 1.0)\n"
-                  << "  [to_gray]: Convert to grayscale (0 or 1, default: 0)\n";
+                  << "  [to_gray]: Convert to grayscale (0 or 1, default: 0)\n"
+                  << CommandLine::compressOptionsUsage()
+                  << "Stream: " << argv[0] << " --stdin --format=<jpg|png|webp> [-q <quality>] [--framed] [options] < input > output\n"
+                  << "Batch: " << argv[0] << " --batch --output-dir=<dir> [options] <input>...\n"
+                  << "Benchmark: " << argv[0] << " --benchmark [task_count]\n";
         return EXIT_FAILURE;
     }
 
-    std::string input_path = argv[1];
-    std::string output_path = argv[2];
-    int         quality = std::stoi(argv[3]);
-    double      scale = (argc >= 5) ? std::stod(argv[4]) : 1.0;
-    bool        toGray = (argc == 6) ? (std::stoi(argv[5]) != 0) : false;
+    std::string input_path = cmd.positional[0];
+    std::string output_path = cmd.positional[1];
+    int         quality = std::stoi(cmd.positional[2]);
+    double      scale = (cmd.positional.size() >= 4) ? std::stod(cmd.positional[3]) : 1.0;
+    bool        toGray = (cmd.positional.size() == 5) ? (std::stoi(cmd.positional[4]) != 0) : false;
     std::string formatString = fs::path(output_path).extension().string();
-    auto        format = stringToFormatEnum(formatString);
+    auto        format = CommandLine::parseFormat(formatString);
 
     if (format == Compressor::Params::_count)
     {
-        std::cerr << "Error: Input file does not exist: " << formatString << '\n';
+        std::cerr << "Error: unsupported output file format: " << formatString << '\n';
         return EXIT_FAILURE;
     }
 
     if (!fs::exists(input_path))
     {
-        std::cerr << "Error: unsupport output file format: " << input_path << '\n';
+        std::cerr << "Error: Input file does not exist: " << input_path << '\n';
         return EXIT_FAILURE;
     }
 
-    cv::Mat image = loadImage(input_path);
+    // JPEG 在解码时就缩小，剩下的比例交给 Compressor
+    int     reduction = 1;
+    cv::Mat image = ImageLoader::load(input_path, scale, toGray, reduction);
     if (image.empty())
-        std::cerr << "Error: Cannot open file: " << input_path << '\n';
-    Compressor             compressor;
-    Compressor::TaskHandle handle = compressor.addCompressionTask(image, {.scale = scale, .quality = quality, .toGray = toGray, .format = format});
-
-    while (!compressor.checkTaskFinished(handle))
-        std::this_thread::sleep_for(std::chrono::milliseconds{20});
-
-    std::vector<uchar> out = compressor.getCompressResult(handle);
-    if (out.empty())
     {
-        std::cerr << "Error: Failed to compress image: " << output_path << '\n';
-        return EXIT_SUCCESS;
+        std::cerr << "Error: Cannot open file: " << input_path << '\n';
+        return EXIT_FAILURE;
     }
 
-    std::string savePath = std::format("{}_output{}", input_path.substr(0, input_path.rfind('.')), formatString);
-    FILE       *file = nullptr;
-    errno_t     err = fopen_s(&file, savePath.data(), "wb");
-    if (err != 0)
+    param.scale = scale * reduction;
+    param.quality = quality;
+    param.toGray = toGray;
+    param.format = format;
+    // 只压缩一张图，缓存用不上，也省去整张图的哈希
+    Compressor compressor{threads};
+    compressor.setStageCacheBudget(0);
+    compressor.setOutputCacheBudget(0);
+    std::vector<uchar> out = compressor.addCompressionTaskAsync(image, param).get();
+    if (out.empty())
     {
-        std::cerr << "Error: Failed to save image to: " << output_path << '\n';
-        return EXIT_SUCCESS;
+        std::cerr << "Error: Failed to compress image: " << input_path << '\n';
+        return EXIT_FAILURE;
     }
+    if (param.targetSize != 0 && out.size() > param.targetSize)
+        std::cerr << "Warning: " << out.size() << " bytes even at the lowest quality, larger than the target size\n";
 
-    fwrite(out.data(), sizeof(uchar), out.size(), file);
-    err = fclose(file);
-    if (err != 0)
+    if (!writeFile(output_path, out))
     {
         std::cerr << "Error: Failed to save image to: " << output_path << '\n';
-        return EXIT_SUCCESS;
+        return EXIT_FAILURE;
     }
-    std::cout << "Image saved to:" << output_path << '\n';
+    std::cout << "Image saved to: " << output_path << '\n';
     return EXIT_SUCCESS;
 }
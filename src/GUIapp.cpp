@@ -1,6 +1,5 @@
 #include "GUIapp.h"
 #include <cmath>
-#include <opencv2/opencv.hpp>
 
 int GUIapp::start()
 {
@@ -13,8 +12,6 @@ int GUIapp::start()
     if (int res = GUIapp::setupBackend())
         return res;
 
-    cv::setUseOptimized(false);
-
     // Main loop
     bool done = false;
     while (!done)
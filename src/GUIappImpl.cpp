@@ -2,7 +2,9 @@
 #include <opencv2/opencv.hpp>
 #include <imgui_internal.h>
 #include "Compressor.h"
+#include "ImageLoader.h"
 #include <filesystem>
+#include <atomic>
 
 enum ImageStatus
 {
@@ -43,6 +45,55 @@ struct CompressorManager
         static Compressor compressor{};
         return compressor;
     }
+
+    struct FinishedTask
+    {
+        Compressor::TaskHandle handle;
+        std::vector<uchar>     result;
+        bool                   preview; // 缩小到显示尺寸的预览，同一句柄之后还会有全尺寸结果
+    };
+
+    // 提交任务，结果由工作线程推送到 finishedTasks
+    // 以图像数据地址作为来源标识，同一张图片新提交的任务会顶替还没完成的旧任务
+    // 图片比显示区域大时先推送一张 previewMaxSide 大小的预览
+    static Compressor::TaskHandle addTask(const cv::Mat &image, uint64_t contentHash, const Compressor::Params &param, Compressor::Priority priority,
+                                          int previewMaxSide)
+    {
+        auto onFinished = [](Compressor::TaskHandle handle, std::vector<uchar> &&result) {
+            pushFinished(handle, std::move(result), false);
+        };
+        auto onPreview = [](Compressor::TaskHandle handle, std::vector<uchar> &&result) {
+            pushFinished(handle, std::move(result), true);
+        };
+        return get().addCompressionTask(image, param, onFinished,
+                                        {.sourceKey = reinterpret_cast<uintptr_t>(image.data),
+                                         .priority = priority,
+                                         .contentHash = contentHash,
+                                         .previewMaxSide = previewMaxSide,
+                                         .previewCallback = onPreview});
+    }
+
+    // 主线程每帧调用，没有新结果时只读一次原子变量，不加锁
+    static std::vector<FinishedTask> takeFinishedTasks()
+    {
+        if (!hasFinishedTask.load(std::memory_order_acquire))
+            return {};
+        std::unique_lock lock{finishedMutex};
+        hasFinishedTask.store(false, std::memory_order_relaxed);
+        return std::exchange(finishedTasks, {});
+    }
+
+private:
+    static void pushFinished(Compressor::TaskHandle handle, std::vector<uchar> &&result, bool preview)
+    {
+        std::unique_lock lock{finishedMutex};
+        finishedTasks.emplace_back(handle, std::move(result), preview);
+        hasFinishedTask.store(true, std::memory_order_release);
+    }
+
+    inline static std::mutex                finishedMutex;
+    inline static std::vector<FinishedTask> finishedTasks;
+    inline static std::atomic<bool>         hasFinishedTask = false;
 };
 
 using ImageTextureRes = std::unique_ptr<ID3D11ShaderResourceView, ImageTextureResDeleter>;
@@ -53,6 +104,7 @@ struct ImageData
     std::vector<uchar>     compressedImage{};
     std::wstring           inputImagePath = L"";
     long                   inputImageSize = 0;
+    uint64_t               contentHash = 0; // 载入时算一次，供编码结果缓存使用
     Compressor::TaskHandle compressHandle = Compressor::InalidHandle;
 
     struct
@@ -81,6 +133,7 @@ static std::vector<ImageData> openedImages{};
 
 static uint32_t activeImageTabIdx = 0;   // 选中的选项卡的索引
 static bool     activateLastTab = false; // 是否选中最后一个选项卡，用于打开一个新图片时
+static int      previewMaxSide = 1024;   // 预览的长边，跟随图片显示区域的大小
 
 static std::vector<std::wstring> droppedImages{}; // 拖拽打开的文件（路径）
 
@@ -99,29 +152,17 @@ namespace
 
     cv::Mat openImageFile(std::wstring_view filePath, long &size)
     {
-        // 宽字符路径得用支持宽字符的文件操作
-        FILE *file = _wfopen(filePath.data(), L"rb");
-        if (!file)
+        // 宽字符路径得用支持宽字符的文件操作，std::filesystem::path 在 Windows 上按宽字符打开
+        std::filesystem::path path{filePath};
+        std::error_code       ec;
+        auto                  fileSize = std::filesystem::file_size(path, ec);
+        if (ec)
             return {};
+        size = static_cast<long>(fileSize);
 
-        // 读取文件到缓冲区
-        fseek(file, 0, SEEK_END);
-        long fileSize = size = ftell(file);
-        fseek(file, 0, SEEK_SET);
-
-        std::vector<uchar> buffer(fileSize);
-        fread(buffer.data(), sizeof(uchar), fileSize, file);
-        fclose(file);
-
-        // 将文件解码为图像对象
-        try
-        {
-            return cv::imdecode(buffer, cv::IMREAD_UNCHANGED);
-        } catch (const cv::Exception &e)
-        {
-            std::cerr << "OpenCV Error: " << e.what() << '\n';
-            return {};
-        }
+        // 界面上要显示原图，缩放比例也随时会调，按原尺寸解码
+        int reduction = 1;
+        return ImageLoader::load(path, 1.0, false, reduction);
     }
 
     std::vector<uchar> encodeImage(const cv::Mat &image, Compressor::Params::Format format)
@@ -317,9 +358,10 @@ void GUIapp::GUIappImpl::showUI_imageDisplay()
                                     &openedImageIter->windowOpened, flag)) // 选中的选项卡
             {
                 // 按需将图片载入gpu
-                if (openedImageIter->imageStatus == ImageStatus::IMAGE_COMPRESSED && !openedImageIter->cache.isCompressedTexture)
+                if ((openedImageIter->imageStatus == ImageStatus::IMAGE_COMPRESSED || openedImageIter->imageStatus == ImageStatus::COMPRESSING)
+                    && !openedImageIter->compressedImage.empty() && !openedImageIter->cache.isCompressedTexture)
                 {
-                    // 已压缩完毕，载入压缩后的图像
+                    // 已压缩完毕或收到预览，载入压缩后的图像
                     openedImageIter->cache.compressedImage = cv::imdecode(openedImageIter->compressedImage, cv::IMREAD_UNCHANGED);
                     openedImageIter->cache.isCompressedTexture = true;
                     openedImageIter->textureStatus = loadTextureFromMemory(openedImageIter->cache.compressedImage,
@@ -336,6 +378,7 @@ void GUIapp::GUIappImpl::showUI_imageDisplay()
 
                 ImVec2 cursorPos = ImGui::GetCursorPos();
                 ImVec2 contentRegionAvail = ImGui::GetContentRegionAvail();
+                previewMaxSide = std::max(static_cast<int>(std::max(contentRegionAvail.x, contentRegionAvail.y)), 256);
                 if (openedImageIter->textureStatus.result == TextureLoadResult::OK)
                 {
                     // 根据窗口大小和图片大小调整显示比例
@@ -369,6 +412,7 @@ void GUIapp::GUIappImpl::showUI_imageDisplay()
             else if (!openedImageIter->windowOpened) // 选项卡被关闭
             {
                 CompressorManager::get().removeTask(openedImageIter->compressHandle);
+                CompressorManager::get().evictSource(openedImageIter->loadedImage);
                 openedImageIter = openedImages.erase(openedImageIter);
             }
             else // 选项卡未被选中
@@ -394,6 +438,7 @@ void GUIapp::GUIappImpl::showUI_compressOptions()
             image.loadedImage = openImageFile(image.inputImagePath, image.inputImageSize);
             if (!image.loadedImage.empty())
             {
+                image.contentHash = Compressor::hashImage(image.loadedImage);
                 image.imageStatus = ImageStatus::PEDDING_FOR_COMPRESS;
                 image.cache.filenameShownOnTabBar = wstringToUTF8string(std::filesystem::path{image.inputImagePath}.filename());
                 openedImages.emplace_back(std::move(image));
@@ -487,15 +532,25 @@ void GUIapp::GUIappImpl::refreshOpenedImageStatus()
 
     static auto lastTime = std::chrono::steady_clock::now();
 
-    Compressor &imgCompressor = CompressorManager::get();
+    // 选中的选项卡优先压缩，切换选项卡时调整排队中任务的优先级
+    static uint32_t lastActiveImageTabIdx = activeImageTabIdx;
+    if (lastActiveImageTabIdx != activeImageTabIdx)
+    {
+        if (lastActiveImageTabIdx < openedImages.size())
+            CompressorManager::get().setTaskPriority(openedImages[lastActiveImageTabIdx].compressHandle, Compressor::Priority::Normal);
+        if (activeImageTabIdx < openedImages.size())
+            CompressorManager::get().setTaskPriority(openedImages[activeImageTabIdx].compressHandle, Compressor::Priority::Interactive);
+        lastActiveImageTabIdx = activeImageTabIdx;
+    }
+
+    std::vector<CompressorManager::FinishedTask> finishedTasks = CompressorManager::takeFinishedTasks();
     for (auto &&image : openedImages)
     {
         auto now = std::chrono::steady_clock::now();
         noChangeDuration += std::chrono::duration_cast<std::chrono::milliseconds>(now - lastTime);
         lastTime = now;
-        // 压缩参数改变时
+        // 压缩参数改变时，正在压缩的旧任务会在提交新任务时被顶替
         if (image.imageStatus != ImageStatus::UNLOADED
-            && image.imageStatus != ImageStatus::COMPRESSING
             && image.compressParams_old != image.compressParams)
         {
             image.imageStatus = ImageStatus::PEDDING_FOR_COMPRESS;
@@ -507,16 +562,37 @@ void GUIapp::GUIappImpl::refreshOpenedImageStatus()
             && (noChangeDuration > 360ms || image.compressedImage.empty()))
         {
             noChangeDuration = 0ms;
-            image.compressHandle = imgCompressor.addCompressionTask(image.loadedImage, image.compressParams);
+            bool isActive = &image - openedImages.data() == activeImageTabIdx;
+            image.compressHandle = CompressorManager::addTask(image.loadedImage, image.contentHash, image.compressParams,
+                                                              isActive ? Compressor::Priority::Interactive : Compressor::Priority::Normal, previewMaxSide);
             image.imageStatus = ImageStatus::COMPRESSING;
         }
-        if (image.imageStatus == ImageStatus::COMPRESSING && imgCompressor.checkTaskFinished(image.compressHandle))
+        if (image.imageStatus != ImageStatus::COMPRESSING)
+            continue;
+        // 预览与全尺寸结果可能在同一帧到达，按推送顺序处理，全尺寸结果总在后面
+        for (auto &&finished : finishedTasks)
         {
+            if (finished.handle != image.compressHandle)
+                continue;
+            if (finished.preview)
+            {
+                // 预览只替换显示的图像，状态仍是压缩中
+                if (!finished.result.empty())
+                {
+                    image.cache.isCompressedTexture = false;
+                    CompressorManager::get().recycleBuffer(std::move(image.compressedImage));
+                    image.compressedImage = std::move(finished.result);
+                }
+                continue;
+            }
             image.imageStatus = ImageStatus::IMAGE_COMPRESSED;
             image.cache.isCompressedTexture = false;
-            image.compressedImage = imgCompressor.getCompressResult(image.compressHandle);
+            CompressorManager::get().recycleBuffer(std::move(image.compressedImage));
+            image.compressedImage = std::move(finished.result);
+            image.compressHandle = Compressor::InalidHandle;
             if (image.compressedImage.empty())
                 image.imageStatus = ImageStatus::COMPRESS_ERROR;
+            break;
         }
     }
 }
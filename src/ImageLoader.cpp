@@ -0,0 +1,225 @@
+#include "ImageLoader.h"
+#include "PooledMatAllocator.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    constexpr std::size_t ReadChunkSize = 1 << 20;
+
+    // 只读映射整个文件，析构时解除映射。不能映射的文件（管道、/dev/stdin、procfs、部分网络文件系统）
+    // 改为从同一个句柄读进缓冲区，管道只能打开读取一次。打不开、读取失败或为空时 size() 为 0
+    class MappedFile
+    {
+    public:
+        explicit MappedFile(const std::filesystem::path &path)
+        {
+#ifdef _WIN32
+            HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+            if (file == INVALID_HANDLE_VALUE)
+                return;
+            LARGE_INTEGER fileSize{};
+            if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+            {
+                if (HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr))
+                {
+                    this->mData = static_cast<const uchar *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+                    if (this->mData)
+                    {
+                        this->mSize = static_cast<std::size_t>(fileSize.QuadPart);
+                        this->mMapped = true;
+                    }
+                    // 视图会保持映射对象存活，句柄可以先关掉
+                    CloseHandle(mapping);
+                }
+            }
+            if (!this->mMapped)
+            {
+                for (;;)
+                {
+                    std::size_t used = this->mBuffer.size();
+                    DWORD       count = 0;
+                    this->mBuffer.resize(used + ReadChunkSize);
+                    BOOL ok = ReadFile(file, this->mBuffer.data() + used, static_cast<DWORD>(ReadChunkSize), &count, nullptr);
+                    this->mBuffer.resize(used + count);
+                    // 管道的写端关闭时 ReadFile 以 ERROR_BROKEN_PIPE 失败，相当于读到结尾
+                    if (!ok && GetLastError() != ERROR_BROKEN_PIPE)
+                        this->mBuffer.clear();
+                    if (!ok || count == 0)
+                        break;
+                }
+                this->mData = this->mBuffer.data();
+                this->mSize = this->mBuffer.size();
+            }
+            CloseHandle(file);
+#else
+            int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+                return;
+            struct stat st{};
+            if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+            {
+                void *data = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data != MAP_FAILED)
+                {
+                    // 解码器从头到尾读一遍，让内核加大预读，读过的页也可以尽早回收
+                    madvise(data, static_cast<std::size_t>(st.st_size), MADV_SEQUENTIAL);
+                    this->mData = static_cast<const uchar *>(data);
+                    this->mSize = static_cast<std::size_t>(st.st_size);
+                    this->mMapped = true;
+                }
+            }
+            if (!this->mMapped)
+            {
+                for (;;)
+                {
+                    std::size_t used = this->mBuffer.size();
+                    this->mBuffer.resize(used + ReadChunkSize);
+                    ssize_t count = ::read(fd, this->mBuffer.data() + used, ReadChunkSize);
+                    this->mBuffer.resize(used + static_cast<std::size_t>(std::max<ssize_t>(count, 0)));
+                    if (count < 0 && errno == EINTR)
+                        continue;
+                    if (count < 0)
+                        this->mBuffer.clear();
+                    if (count <= 0)
+                        break;
+                }
+                this->mData = this->mBuffer.data();
+                this->mSize = this->mBuffer.size();
+            }
+            close(fd);
+#endif
+        }
+
+        ~MappedFile()
+        {
+            if (!this->mMapped)
+                return;
+#ifdef _WIN32
+            UnmapViewOfFile(this->mData);
+#else
+            munmap(const_cast<uchar *>(this->mData), this->mSize);
+#endif
+        }
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        const uchar *data() const { return this->mData; }
+        std::size_t  size() const { return this->mSize; }
+
+    private:
+        const uchar       *mData = nullptr;
+        std::size_t        mSize = 0;
+        bool               mMapped = false;
+        std::vector<uchar> mBuffer; // 不能映射时读进来的内容
+    };
+
+    // JPEG 帧头（SOFn）里的颜色分量数，不是 JPEG 或没找到帧头时返回 0
+    int jpegComponents(const uchar *data, std::size_t size)
+    {
+        if (size < 4 || data[0] != 0xFF || data[1] != 0xD8)
+            return 0;
+
+        std::size_t pos = 2;
+        while (pos + 4 <= size)
+        {
+            if (data[pos] != 0xFF)
+                return 0;
+            uchar marker = data[pos + 1];
+            if (marker == 0xFF) // 段之间的填充字节
+            {
+                ++pos;
+                continue;
+            }
+            // SOF0-SOF15，C4（DHT）、C8（JPG）、CC（DAC）不是帧头。段内依次为长度、精度、高、宽、分量数
+            if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+                return pos + 9 < size ? data[pos + 9] : 0;
+            pos += 2 + ((std::size_t(data[pos + 2]) << 8) | data[pos + 3]);
+        }
+        return 0;
+    }
+
+    // 不超过 1 / scale 的最大缩小倍数
+    int reductionFor(double scale)
+    {
+        for (int reduction : {8, 4, 2})
+        {
+            if (scale > 0.0 && scale * reduction <= 1.0)
+                return reduction;
+        }
+        return 1;
+    }
+} // namespace
+
+cv::Mat ImageLoader::decode(const uchar *data, std::size_t size, double scale, bool toGray, int &reduction)
+{
+    reduction = 1;
+    int flags = cv::IMREAD_UNCHANGED;
+
+    // 只对 JPEG 缩小解码：其他格式的 IMREAD_REDUCED_* 也是先完整解码再缩小，还会丢掉透明通道和 16 位深度。
+    // IMREAD_REDUCED_* 隐含颜色转换与 EXIF 方向校正，这里按分量数选择彩色或灰度，并忽略方向，与 IMREAD_UNCHANGED 的结果保持一致
+    int components = jpegComponents(data, size);
+    int candidate = reductionFor(scale);
+    if (components != 0 && candidate != 1)
+    {
+        bool gray = toGray || components == 1;
+        switch (candidate)
+        {
+        case 2:
+            flags = gray ? cv::IMREAD_REDUCED_GRAYSCALE_2 : cv::IMREAD_REDUCED_COLOR_2;
+            break;
+        case 4:
+            flags = gray ? cv::IMREAD_REDUCED_GRAYSCALE_4 : cv::IMREAD_REDUCED_COLOR_4;
+            break;
+        default:
+            flags = gray ? cv::IMREAD_REDUCED_GRAYSCALE_8 : cv::IMREAD_REDUCED_COLOR_8;
+            break;
+        }
+        flags |= cv::IMREAD_IGNORE_ORIENTATION;
+        reduction = candidate;
+    }
+
+    // imdecode 的输入是单行 Mat，长度受 int 限制
+    if (size > INT_MAX)
+    {
+        std::cerr << "Error: Image file is too large to decode: " << size << " bytes\n";
+        return {};
+    }
+
+    try
+    {
+        cv::Mat image = PooledMatAllocator::makeMat();
+        // 只给 imdecode 一个指向原数据的 Mat 头，不复制文件内容
+        cv::imdecode(cv::Mat(1, static_cast<int>(size), CV_8U, const_cast<uchar *>(data)), flags, &image);
+        if (image.empty())
+            reduction = 1;
+        return image;
+    } catch (const cv::Exception &e)
+    {
+        std::cerr << "OpenCV Error: " << e.what() << '\n';
+        reduction = 1;
+        return {};
+    }
+}
+
+cv::Mat ImageLoader::load(const std::filesystem::path &path, double scale, bool toGray, int &reduction)
+{
+    reduction = 1;
+    MappedFile file{path};
+    if (file.size() == 0)
+        return {};
+    return ImageLoader::decode(file.data(), file.size(), scale, toGray, reduction);
+}
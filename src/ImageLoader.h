@@ -0,0 +1,20 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <filesystem>
+
+// 读取并解码输入图像，GUI 与命令行共用
+// 文件通过 mmap（Windows 上为文件映射）交给 imdecode，省去一次复制，几百 MB 的 TIFF、PNG 也不会先整块读进内存；
+// 管道等不能映射的文件退回读进缓冲区
+// 像素内存来自 PooledMatAllocator；已知之后要缩小时，JPEG 直接按 1/2、1/4、1/8 解码，
+// 在 DCT 域缩小几乎不花额外时间，也只占缩小后的内存，剩下的缩放再交给 Compressor
+class ImageLoader
+{
+public:
+    // scale 为之后要缩放到的比例，toGray 表示之后要转灰度。
+    // reduction 返回解码时已经缩小的倍数（1、2、4、8），调用方应改用 scale * reduction 继续缩放
+    static cv::Mat decode(const uchar *data, std::size_t size, double scale, bool toGray, int &reduction);
+
+    // 把文件只读映射到内存后直接解码，不先复制到缓冲区；不能映射时读进缓冲区再解码。失败返回空 Mat
+    static cv::Mat load(const std::filesystem::path &path, double scale, bool toGray, int &reduction);
+};
@@ -0,0 +1,175 @@
+#include "ImageMetrics.h"
+#include <cmath>
+#include <limits>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#define IMG_METRICS_SSE2 1
+#endif
+
+namespace
+{
+    struct BlockSums
+    {
+        uint32_t sx = 0, sy = 0;
+        uint64_t sxx = 0, syy = 0, sxy = 0;
+    };
+
+#if IMG_METRICS_SSE2
+    int32_t horizontalSum(__m128i v)
+    {
+        v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+        v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtsi128_si32(v);
+    }
+
+    // 一个 8x8 块的各项和，平方和最大 64*255*255，int32 放得下
+    BlockSums sumBlock8x8(const uchar *a, std::size_t strideA, const uchar *b, std::size_t strideB)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i       sx = zero, sy = zero, sxx = zero, syy = zero, sxy = zero;
+        for (int row = 0; row < 8; ++row, a += strideA, b += strideB)
+        {
+            __m128i x8 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(a));
+            __m128i y8 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(b));
+            __m128i x16 = _mm_unpacklo_epi8(x8, zero);
+            __m128i y16 = _mm_unpacklo_epi8(y8, zero);
+            sx = _mm_add_epi64(sx, _mm_sad_epu8(x8, zero));
+            sy = _mm_add_epi64(sy, _mm_sad_epu8(y8, zero));
+            sxx = _mm_add_epi32(sxx, _mm_madd_epi16(x16, x16));
+            syy = _mm_add_epi32(syy, _mm_madd_epi16(y16, y16));
+            sxy = _mm_add_epi32(sxy, _mm_madd_epi16(x16, y16));
+        }
+        return {static_cast<uint32_t>(_mm_cvtsi128_si32(sx)), static_cast<uint32_t>(_mm_cvtsi128_si32(sy)),
+                static_cast<uint64_t>(horizontalSum(sxx)), static_cast<uint64_t>(horizontalSum(syy)), static_cast<uint64_t>(horizontalSum(sxy))};
+    }
+
+    // 一行的差值平方和，每次处理 16 个像素
+    uint64_t sumSquaredDiffRow(const uchar *a, const uchar *b, int width)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i       acc = zero;
+        int           x = 0;
+        for (; x + 16 <= width; x += 16)
+        {
+            __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + x));
+            __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + x));
+            // |a - b| 用两次饱和减法得到，再扩展成 16 位求平方和
+            __m128i diff = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+            __m128i lo = _mm_unpacklo_epi8(diff, zero);
+            __m128i hi = _mm_unpackhi_epi8(diff, zero);
+            __m128i sq = _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi));
+            acc = _mm_add_epi64(acc, _mm_add_epi64(_mm_unpacklo_epi32(sq, zero), _mm_unpackhi_epi32(sq, zero)));
+        }
+        uint64_t sum = static_cast<uint64_t>(_mm_cvtsi128_si64(acc)) + static_cast<uint64_t>(_mm_cvtsi128_si64(_mm_unpackhi_epi64(acc, acc)));
+        for (; x < width; ++x)
+        {
+            int d = a[x] - b[x];
+            sum += d * d;
+        }
+        return sum;
+    }
+#else
+    BlockSums sumBlock8x8(const uchar *a, std::size_t strideA, const uchar *b, std::size_t strideB)
+    {
+        BlockSums sums;
+        for (int row = 0; row < 8; ++row, a += strideA, b += strideB)
+        {
+            for (int col = 0; col < 8; ++col)
+            {
+                uint32_t x = a[col], y = b[col];
+                sums.sx += x;
+                sums.sy += y;
+                sums.sxx += x * x;
+                sums.syy += y * y;
+                sums.sxy += x * y;
+            }
+        }
+        return sums;
+    }
+
+    uint64_t sumSquaredDiffRow(const uchar *a, const uchar *b, int width)
+    {
+        uint64_t sum = 0;
+        for (int x = 0; x < width; ++x)
+        {
+            int d = a[x] - b[x];
+            sum += d * d;
+        }
+        return sum;
+    }
+#endif
+} // namespace
+
+double ImageMetrics::ssim(const cv::Mat &a, const cv::Mat &b)
+{
+    cv::Mat grayA = ImageMetrics::toGray8U(a), grayB = ImageMetrics::toGray8U(b);
+    if (grayA.empty() || grayA.size() != grayB.size())
+        return 0.0;
+
+    constexpr double C1 = (0.01 * 255) * (0.01 * 255);
+    constexpr double C2 = (0.03 * 255) * (0.03 * 255);
+    constexpr double N = 64.0;
+
+    double total = 0.0;
+    int    blocks = 0;
+    for (int y = 0; y + 8 <= grayA.rows; y += 8)
+    {
+        const uchar *rowA = grayA.ptr(y), *rowB = grayB.ptr(y);
+        for (int x = 0; x + 8 <= grayA.cols; x += 8)
+        {
+            BlockSums s = sumBlock8x8(rowA + x, grayA.step[0], rowB + x, grayB.step[0]);
+
+            double muX = s.sx / N, muY = s.sy / N;
+            double varX = s.sxx / N - muX * muX;
+            double varY = s.syy / N - muY * muY;
+            double cov = s.sxy / N - muX * muY;
+            total += ((2 * muX * muY + C1) * (2 * cov + C2)) / ((muX * muX + muY * muY + C1) * (varX + varY + C2));
+            ++blocks;
+        }
+    }
+    return blocks ? total / blocks : 1.0;
+}
+
+double ImageMetrics::psnr(const cv::Mat &a, const cv::Mat &b)
+{
+    cv::Mat grayA = ImageMetrics::toGray8U(a), grayB = ImageMetrics::toGray8U(b);
+    if (grayA.empty() || grayA.size() != grayB.size())
+        return 0.0;
+
+    uint64_t sum = 0;
+    for (int y = 0; y < grayA.rows; ++y)
+        sum += sumSquaredDiffRow(grayA.ptr(y), grayB.ptr(y), grayA.cols);
+    if (sum == 0)
+        return std::numeric_limits<double>::infinity();
+
+    double mse = static_cast<double>(sum) / (static_cast<double>(grayA.rows) * grayA.cols);
+    return 10.0 * std::log10(255.0 * 255.0 / mse);
+}
+
+cv::Mat ImageMetrics::toGray8U(const cv::Mat &image)
+{
+    if (image.empty())
+        return {};
+
+    cv::Mat depth8U = image;
+    if (image.depth() == CV_16U)
+        image.convertTo(depth8U, CV_8U, 1.0 / 257.0);
+    else if (image.depth() != CV_8U)
+        image.convertTo(depth8U, CV_8U);
+
+    cv::Mat gray;
+    switch (depth8U.channels())
+    {
+    case 1:
+        return depth8U;
+    case 3:
+        cv::cvtColor(depth8U, gray, cv::COLOR_BGR2GRAY);
+        return gray;
+    case 4:
+        cv::cvtColor(depth8U, gray, cv::COLOR_BGRA2GRAY);
+        return gray;
+    default:
+        return {};
+    }
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+// 图像质量指标，用于按感知质量搜索压缩参数
+// 两幅图尺寸必须相同，彩色图先转为 8 位灰度再比较
+class ImageMetrics
+{
+public:
+    // 8x8 不重叠分块 SSIM 的平均值，不足一块的边缘忽略
+    static double ssim(const cv::Mat &a, const cv::Mat &b);
+
+    // 峰值信噪比（dB），两图完全相同时返回正无穷
+    static double psnr(const cv::Mat &a, const cv::Mat &b);
+
+    // 转为 8 位单通道，已经是的直接返回原图（不复制）
+    static cv::Mat toGray8U(const cv::Mat &image);
+};
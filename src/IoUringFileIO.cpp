@@ -0,0 +1,562 @@
+#include "IoUringFileIO.h"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace
+{
+    constexpr uint64_t WakeupTag = 0; // 唤醒用的 eventfd 读取，其余 user_data 都是 Request 指针
+
+    // 内核暂时拒绝提交、又没有在途的操作可等时，隔一会儿再试，连续失败这么多次后放弃
+    constexpr std::chrono::milliseconds SubmitRetryDelay{10};
+    constexpr uint32_t                  MaxSubmitRetries = 100;
+
+    constexpr std::size_t StreamChunkSize = 1 << 20; // 大小未知的文件每次扩充的读缓冲区大小
+
+    int ioUringSetup(unsigned entries, io_uring_params *params)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+    }
+
+    int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+    }
+
+    int ioUringRegister(int fd, unsigned opcode, void *arg, unsigned count)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, count));
+    }
+
+    // 用到的操作都要支持（5.6 起），否则整个后端不可用
+    bool supportsRequiredOps(int ringFd)
+    {
+        constexpr unsigned probeOps = 256;
+        std::vector<unsigned char> storage(sizeof(io_uring_probe) + probeOps * sizeof(io_uring_probe_op));
+        auto                      *probe = reinterpret_cast<io_uring_probe *>(storage.data());
+        if (ioUringRegister(ringFd, IORING_REGISTER_PROBE, probe, probeOps) < 0)
+            return false;
+        for (unsigned op : {IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_READ_FIXED, IORING_OP_WRITE, IORING_OP_CLOSE})
+        {
+            if (op >= probe->ops_len || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+                return false;
+        }
+        return true;
+    }
+
+    template <typename T>
+    T *ringField(void *ring, uint32_t offset)
+    {
+        return reinterpret_cast<T *>(static_cast<char *>(ring) + offset);
+    }
+} // namespace
+
+struct IoUringFileIO::Request
+{
+    enum class Stage : uint8_t
+    {
+        Open,
+        Stat,
+        Transfer,
+        Close
+    };
+
+    bool               write = false;
+    bool               ok = false;
+    bool               sizeUnknown = false; // statx 报告的大小为 0（管道、procfs），分块读到文件末尾
+    Stage              stage = Stage::Open;
+    std::string        path; // OPENAT 完成前必须保持有效
+    int                fd = -1;
+    int                slot = -1;
+    uchar             *data = nullptr;
+    std::size_t        size = 0;
+    std::size_t        done = 0;
+    std::vector<uchar> bytes;
+    struct statx       stx{};
+    ReadCallback       onRead;
+    WriteCallback      onWrite;
+};
+
+std::unique_ptr<AsyncFileIO> IoUringFileIO::create(uint32_t depth)
+{
+    std::unique_ptr<IoUringFileIO> io{new IoUringFileIO};
+    if (!io->setup(std::max(depth, 1u)))
+        return nullptr;
+    return io;
+}
+
+IoUringFileIO::~IoUringFileIO()
+{
+    if (this->mRingThread.joinable())
+    {
+        {
+            std::unique_lock lock{this->mIncomingMutex};
+            this->mStopping = true;
+        }
+        eventfd_write(this->mWakeFd, 1);
+        this->mRingThread.join();
+    }
+
+    if (this->mSqes)
+        munmap(this->mSqes, this->mSqesSize);
+    if (this->mCqRing && this->mCqRing != this->mSqRing)
+        munmap(this->mCqRing, this->mCqRingSize);
+    if (this->mSqRing)
+        munmap(this->mSqRing, this->mSqRingSize);
+    if (this->mRingFd >= 0)
+        close(this->mRingFd);
+    if (this->mWakeFd >= 0)
+        close(this->mWakeFd);
+    // 注册缓冲区随 ring 关闭注销
+    if (this->mSlotMemory)
+        munmap(this->mSlotMemory, this->mSlotSize * this->mSlotCount);
+}
+
+bool IoUringFileIO::setup(uint32_t depth)
+{
+    // 每个请求同时只有一个操作在途，再加一个唤醒用的读取，提交队列不会满；完成队列默认是提交队列的两倍
+    io_uring_params params{};
+    this->mRingFd = ioUringSetup(std::bit_ceil(depth + 1), &params);
+    if (this->mRingFd < 0 || !supportsRequiredOps(this->mRingFd))
+        return false;
+
+    this->mSqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    this->mCqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMmap)
+        this->mSqRingSize = this->mCqRingSize = std::max(this->mSqRingSize, this->mCqRingSize);
+
+    void *sqRing = mmap(nullptr, this->mSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->mRingFd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED)
+        return false;
+    this->mSqRing = sqRing;
+    void *cqRing = singleMmap ? sqRing : mmap(nullptr, this->mCqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->mRingFd, IORING_OFF_CQ_RING);
+    if (cqRing == MAP_FAILED)
+        return false;
+    this->mCqRing = cqRing;
+    this->mSqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = mmap(nullptr, this->mSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->mRingFd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+        return false;
+    this->mSqes = static_cast<io_uring_sqe *>(sqes);
+
+    this->mSqHead = ringField<unsigned>(sqRing, params.sq_off.head);
+    this->mSqTail = ringField<unsigned>(sqRing, params.sq_off.tail);
+    this->mSqMask = ringField<unsigned>(sqRing, params.sq_off.ring_mask);
+    this->mSqArray = ringField<unsigned>(sqRing, params.sq_off.array);
+    this->mCqHead = ringField<unsigned>(cqRing, params.cq_off.head);
+    this->mCqTail = ringField<unsigned>(cqRing, params.cq_off.tail);
+    this->mCqMask = ringField<unsigned>(cqRing, params.cq_off.ring_mask);
+    this->mCqes = ringField<io_uring_cqe>(cqRing, params.cq_off.cqes);
+    this->mSqLocalTail = *this->mSqTail;
+
+    this->mWakeFd = eventfd(0, EFD_CLOEXEC);
+    if (this->mWakeFd < 0)
+        return false;
+
+    this->mDepth = depth;
+    this->registerBuffers(depth);
+    this->mRingThread = std::thread(&IoUringFileIO::ringThreadFunc, this);
+    return true;
+}
+
+void IoUringFileIO::registerBuffers(uint32_t count)
+{
+    for (std::size_t slotSize = RegisteredSlotSize; slotSize >= MinRegisteredSlotSize; slotSize /= 2)
+    {
+        void *memory = mmap(nullptr, slotSize * count, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED)
+            return;
+
+        std::vector<iovec> iovecs(count);
+        for (uint32_t i = 0; i < count; ++i)
+            iovecs[i] = {static_cast<char *>(memory) + i * slotSize, slotSize};
+        if (ioUringRegister(this->mRingFd, IORING_REGISTER_BUFFERS, iovecs.data(), count) == 0)
+        {
+            this->mSlotMemory = static_cast<unsigned char *>(memory);
+            this->mSlotSize = slotSize;
+            this->mSlotCount = count;
+            for (int slot = static_cast<int>(count) - 1; slot >= 0; --slot)
+                this->mFreeSlots.push_back(slot);
+            return;
+        }
+        munmap(memory, slotSize * count);
+    }
+}
+
+void IoUringFileIO::read(std::filesystem::path path, ReadCallback callback)
+{
+    auto request = std::make_unique<Request>();
+    request->path = path.native();
+    request->onRead = std::move(callback);
+    this->enqueue(std::move(request));
+}
+
+void IoUringFileIO::write(std::filesystem::path path, std::vector<uchar> &&bytes, WriteCallback callback)
+{
+    auto request = std::make_unique<Request>();
+    request->write = true;
+    request->path = path.native();
+    request->bytes = std::move(bytes);
+    request->onWrite = std::move(callback);
+    this->enqueue(std::move(request));
+}
+
+void IoUringFileIO::enqueue(std::unique_ptr<Request> request)
+{
+    {
+        std::unique_lock lock{this->mIncomingMutex};
+        this->mIncoming.push_back(std::move(request));
+    }
+    eventfd_write(this->mWakeFd, 1);
+}
+
+void IoUringFileIO::releaseBuffer(int slot, std::vector<uchar> &&heap)
+{
+    if (slot < 0)
+    {
+        AsyncFileIO::releaseBuffer(slot, std::move(heap));
+        return;
+    }
+    std::unique_lock lock{this->mSlotMutex};
+    this->mFreeSlots.push_back(slot);
+}
+
+void IoUringFileIO::ringThreadFunc()
+{
+    this->armWakeup();
+    for (;;)
+    {
+        {
+            std::unique_lock lock{this->mIncomingMutex};
+            while (this->mActive < this->mDepth && !this->mIncoming.empty())
+            {
+                Request *request = this->mIncoming.front().release();
+                this->mIncoming.pop_front();
+                ++this->mActive;
+
+                io_uring_sqe *sqe = this->nextSqe(reinterpret_cast<uint64_t>(request));
+                sqe->opcode = IORING_OP_OPENAT;
+                sqe->fd = AT_FDCWD;
+                sqe->addr = reinterpret_cast<uint64_t>(request->path.c_str());
+                sqe->open_flags = request->write ? O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC : O_RDONLY | O_CLOEXEC;
+                sqe->len = request->write ? 0644 : 0;
+            }
+            if (this->mStopping && this->mActive == 0 && this->mIncoming.empty())
+                return;
+        }
+        this->submitAndWait();
+        this->reap();
+    }
+}
+
+io_uring_sqe *IoUringFileIO::nextSqe(uint64_t userData)
+{
+    unsigned      index = this->mSqLocalTail & *this->mSqMask;
+    io_uring_sqe *sqe = &this->mSqes[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = userData;
+    this->mSqArray[index] = index;
+    ++this->mSqLocalTail;
+    ++this->mToSubmit;
+    return sqe;
+}
+
+void IoUringFileIO::armWakeup()
+{
+    io_uring_sqe *sqe = this->nextSqe(WakeupTag);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = this->mWakeFd;
+    sqe->addr = reinterpret_cast<uint64_t>(&this->mWakeValue);
+    sqe->len = sizeof(this->mWakeValue);
+}
+
+void IoUringFileIO::prepTransfer(Request *request)
+{
+    io_uring_sqe *sqe = this->nextSqe(reinterpret_cast<uint64_t>(request));
+    sqe->fd = request->fd;
+    sqe->addr = reinterpret_cast<uint64_t>(request->data + request->done);
+    sqe->len = static_cast<uint32_t>(std::min(request->size - request->done, MaxTransferSize));
+    sqe->off = request->done;
+    if (request->write)
+    {
+        sqe->opcode = IORING_OP_WRITE;
+    }
+    else if (request->slot >= 0)
+    {
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->buf_index = static_cast<uint16_t>(request->slot);
+    }
+    else
+    {
+        sqe->opcode = IORING_OP_READ;
+    }
+}
+
+void IoUringFileIO::prepClose(Request *request)
+{
+    request->stage = Request::Stage::Close;
+    io_uring_sqe *sqe = this->nextSqe(reinterpret_cast<uint64_t>(request));
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = request->fd;
+}
+
+void IoUringFileIO::advance(Request *request, int result)
+{
+    switch (request->stage)
+    {
+    case Request::Stage::Open:
+        if (result < 0)
+        {
+            this->complete(request);
+            return;
+        }
+        request->fd = result;
+        if (request->write)
+        {
+            request->stage = Request::Stage::Transfer;
+            request->data = request->bytes.data();
+            request->size = request->bytes.size();
+            if (request->size == 0)
+            {
+                request->ok = true;
+                this->prepClose(request);
+                return;
+            }
+            this->prepTransfer(request);
+        }
+        else
+        {
+            request->stage = Request::Stage::Stat;
+            io_uring_sqe *sqe = this->nextSqe(reinterpret_cast<uint64_t>(request));
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = request->fd;
+            sqe->addr = reinterpret_cast<uint64_t>("");
+            sqe->len = STATX_SIZE;
+            sqe->statx_flags = AT_EMPTY_PATH;
+            sqe->off = reinterpret_cast<uint64_t>(&request->stx);
+        }
+        return;
+
+    case Request::Stage::Stat:
+        if (result < 0)
+        {
+            this->prepClose(request);
+            return;
+        }
+        if (request->stx.stx_size == 0)
+        {
+            request->sizeUnknown = true;
+            request->bytes = this->mReadBuffers.acquire();
+            request->bytes.resize(StreamChunkSize);
+            request->size = request->bytes.size();
+            request->data = request->bytes.data();
+            request->stage = Request::Stage::Transfer;
+            this->prepTransfer(request);
+            return;
+        }
+        request->size = static_cast<std::size_t>(request->stx.stx_size);
+        request->slot = this->takeSlot(request->size);
+        if (request->slot >= 0)
+        {
+            request->data = this->mSlotMemory + request->slot * this->mSlotSize;
+        }
+        else
+        {
+            request->bytes = this->mReadBuffers.acquire();
+            request->bytes.resize(request->size);
+            request->data = request->bytes.data();
+        }
+        request->stage = Request::Stage::Transfer;
+        this->prepTransfer(request);
+        return;
+
+    case Request::Stage::Transfer:
+        if (result == -EINTR || result == -EAGAIN)
+        {
+            this->prepTransfer(request);
+            return;
+        }
+        // 大小未知时读到 0 字节就是文件末尾；大小已知时说明文件在读取过程中变短了，按失败处理
+        if (result == 0 && request->sizeUnknown && request->done > 0)
+        {
+            request->bytes.resize(request->done);
+            request->size = request->done;
+            request->ok = true;
+            this->prepClose(request);
+            return;
+        }
+        if (result <= 0)
+        {
+            this->prepClose(request);
+            return;
+        }
+        request->done += static_cast<std::size_t>(result);
+        if (request->done < request->size)
+        {
+            this->prepTransfer(request);
+            return;
+        }
+        if (request->sizeUnknown)
+        {
+            request->bytes.resize(request->size + StreamChunkSize);
+            request->size = request->bytes.size();
+            request->data = request->bytes.data();
+            this->prepTransfer(request);
+            return;
+        }
+        request->ok = true;
+        this->prepClose(request);
+        return;
+
+    case Request::Stage::Close:
+        // 网络文件系统可能到关闭时才报告写入错误
+        if (result < 0)
+            request->ok = false;
+        this->complete(request);
+        return;
+    }
+}
+
+void IoUringFileIO::complete(Request *request)
+{
+    --this->mActive;
+    if (request->write)
+    {
+        request->onWrite(request->ok, std::move(request->bytes));
+    }
+    else if (request->ok)
+    {
+        request->onRead(true, Buffer{this, request->slot, request->data, request->size, std::move(request->bytes)});
+    }
+    else
+    {
+        this->releaseBuffer(request->slot, std::move(request->bytes));
+        request->onRead(false, {});
+    }
+    delete request;
+}
+
+int IoUringFileIO::takeSlot(std::size_t size)
+{
+    if (size > this->mSlotSize)
+        return -1;
+    std::unique_lock lock{this->mSlotMutex};
+    if (this->mFreeSlots.empty())
+        return -1;
+    int slot = this->mFreeSlots.back();
+    this->mFreeSlots.pop_back();
+    return slot;
+}
+
+void IoUringFileIO::submitAndWait()
+{
+    std::atomic_ref<unsigned>{*this->mSqTail}.store(this->mSqLocalTail, std::memory_order_release);
+    for (;;)
+    {
+        int submitted = ioUringEnter(this->mRingFd, this->mToSubmit, 1, IORING_ENTER_GETEVENTS);
+        if (submitted >= 0)
+        {
+            this->mToSubmit -= static_cast<unsigned>(submitted);
+            this->mSubmitRetries = 0;
+            return;
+        }
+        int error = errno;
+        if (error == EINTR)
+            continue;
+
+        // EAGAIN、EBUSY：内核暂时无法接收（请求内存不足、完成队列溢出）。已有完成事件就先回去收割；
+        // 还有已提交的请求就等其中一个完成再重试。每个在途请求恰好有一个操作，
+        // 还没提交的都算在 mToSubmit 里，mActive 更大说明内核里至少有一个请求的操作。
+        // 都没有时只能隔一会儿再试
+        if (error == EAGAIN || error == EBUSY)
+        {
+            if (this->hasCompletions())
+                return;
+            if (this->mActive > this->mToSubmit)
+            {
+                if (ioUringEnter(this->mRingFd, 0, 1, IORING_ENTER_GETEVENTS) >= 0 || errno == EINTR)
+                    return;
+                error = errno;
+            }
+            else if (++this->mSubmitRetries <= MaxSubmitRetries)
+            {
+                std::this_thread::sleep_for(SubmitRetryDelay);
+                continue;
+            }
+        }
+
+        // 其他错误，或者一直提交不进去：还没提交的请求以失败结束，不在这里反复重试
+        std::cerr << "Error: io_uring_enter failed: " << std::strerror(error) << '\n';
+        this->failUnsubmitted();
+        this->mSubmitRetries = 0;
+        std::this_thread::sleep_for(SubmitRetryDelay);
+        return;
+    }
+}
+
+bool IoUringFileIO::hasCompletions() const
+{
+    return *this->mCqHead != std::atomic_ref<unsigned>{*this->mCqTail}.load(std::memory_order_acquire);
+}
+
+// 撤回内核还没取走的提交项，对应的请求以失败结束，已经打开的文件直接关闭。唤醒读取重新填写，下一轮再提交
+void IoUringFileIO::failUnsubmitted()
+{
+    // 没有 SQPOLL 时内核只在 io_uring_enter 里读取提交队列，此时把队尾退回内核的队头是安全的
+    unsigned              head = std::atomic_ref<unsigned>{*this->mSqHead}.load(std::memory_order_acquire);
+    std::vector<uint64_t> userData;
+    for (unsigned i = head; i != this->mSqLocalTail; ++i)
+        userData.push_back(this->mSqes[this->mSqArray[i & *this->mSqMask]].user_data);
+    this->mSqLocalTail = head;
+    this->mToSubmit = 0;
+    std::atomic_ref<unsigned>{*this->mSqTail}.store(head, std::memory_order_release);
+
+    bool rearm = false;
+    for (uint64_t tag : userData)
+    {
+        if (tag == WakeupTag)
+        {
+            rearm = true;
+            continue;
+        }
+        auto *request = reinterpret_cast<Request *>(tag);
+        if (request->fd >= 0)
+            close(request->fd);
+        request->ok = false;
+        this->complete(request);
+    }
+    if (rearm)
+        this->armWakeup();
+}
+
+void IoUringFileIO::reap()
+{
+    unsigned head = *this->mCqHead;
+    unsigned tail = std::atomic_ref<unsigned>{*this->mCqTail}.load(std::memory_order_acquire);
+    for (; head != tail; ++head)
+    {
+        const io_uring_cqe &cqe = this->mCqes[head & *this->mCqMask];
+        uint64_t            userData = cqe.user_data;
+        int                 result = cqe.res;
+        if (userData == WakeupTag)
+            this->armWakeup();
+        else
+            this->advance(reinterpret_cast<Request *>(userData), result);
+    }
+    std::atomic_ref<unsigned>{*this->mCqHead}.store(head, std::memory_order_release);
+}
+#endif
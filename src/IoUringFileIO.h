@@ -0,0 +1,105 @@
+#pragma once
+
+#include "AsyncFileIO.h"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <deque>
+#include <mutex>
+#include <thread>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+// io_uring 后端，直接用系统调用，不依赖 liburing。
+// 一个 ring 线程独占提交与完成队列，每个请求按 打开 →（读取时）statx → 分块读写 → 关闭 的顺序推进，
+// 同一请求同时只有一个操作在途，不同请求的操作同时在途。
+// 读取优先放进注册缓冲区（IORING_REGISTER_BUFFERS + READ_FIXED），省去每次读取时锁定页面；
+// 缓冲区随 Buffer 析构归还，在任务之间循环使用。放不下或槽位用完的文件读进普通内存
+class IoUringFileIO final : public AsyncFileIO
+{
+public:
+    // 内核不支持 io_uring 或所需的操作、或被 seccomp 等禁用时返回空
+    static std::unique_ptr<AsyncFileIO> create(uint32_t depth);
+
+    ~IoUringFileIO() override;
+
+    const char *name() const override { return "io_uring"; }
+
+    void read(std::filesystem::path path, ReadCallback callback) override;
+    void write(std::filesystem::path path, std::vector<uchar> &&bytes, WriteCallback callback) override;
+
+    // 注册缓冲区计入 RLIMIT_MEMLOCK，注册失败时槽位大小逐次减半，小于下限就不用注册缓冲区
+    static constexpr std::size_t RegisteredSlotSize = 4ull << 20;
+    static constexpr std::size_t MinRegisteredSlotSize = 256ull << 10;
+    static constexpr std::size_t MaxTransferSize = 1ull << 30; // 单个读写操作的长度上限
+
+protected:
+    void releaseBuffer(int slot, std::vector<uchar> &&heap) override;
+
+private:
+    struct Request;
+
+    IoUringFileIO() = default;
+
+    bool setup(uint32_t depth);
+    void registerBuffers(uint32_t count);
+    void enqueue(std::unique_ptr<Request> request);
+
+    // 以下只在 ring 线程上调用
+    void          ringThreadFunc();
+    io_uring_sqe *nextSqe(uint64_t userData);
+    void          armWakeup();
+    void          prepTransfer(Request *request);
+    void          prepClose(Request *request);
+    void          advance(Request *request, int result);
+    void          complete(Request *request);
+    int           takeSlot(std::size_t size);
+    void          submitAndWait();
+    bool          hasCompletions() const;
+    void          failUnsubmitted();
+    void          reap();
+
+    int mRingFd = -1;
+    int mWakeFd = -1; // eventfd，提交新请求时写入，唤醒等待完成事件的 ring 线程
+
+    void         *mSqRing = nullptr;
+    void         *mCqRing = nullptr;
+    std::size_t   mSqRingSize = 0;
+    std::size_t   mCqRingSize = 0;
+    io_uring_sqe *mSqes = nullptr;
+    std::size_t   mSqesSize = 0;
+    unsigned     *mSqHead = nullptr;
+    unsigned     *mSqTail = nullptr;
+    unsigned     *mSqMask = nullptr;
+    unsigned     *mSqArray = nullptr;
+    unsigned     *mCqHead = nullptr;
+    unsigned     *mCqTail = nullptr;
+    unsigned     *mCqMask = nullptr;
+    io_uring_cqe *mCqes = nullptr;
+    unsigned      mSqLocalTail = 0; // 已填好、还没发布给内核的提交队列尾
+    unsigned      mToSubmit = 0;
+    uint32_t      mSubmitRetries = 0; // 连续因 EAGAIN、EBUSY 提交失败的次数
+    uint64_t      mWakeValue = 0;
+
+    uint32_t mDepth = 0;  // 同时在途的请求数上限
+    uint32_t mActive = 0; // 在途的请求数
+
+    std::mutex                           mIncomingMutex;
+    std::deque<std::unique_ptr<Request>> mIncoming;
+    bool                                 mStopping = false;
+
+    unsigned char   *mSlotMemory = nullptr;
+    std::size_t      mSlotSize = 0;
+    uint32_t         mSlotCount = 0;
+    std::mutex       mSlotMutex;
+    std::vector<int> mFreeSlots;
+
+    std::thread mRingThread;
+};
+#else
+class IoUringFileIO
+{
+public:
+    static std::unique_ptr<AsyncFileIO> create(uint32_t) { return nullptr; }
+};
+#endif
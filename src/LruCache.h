@@ -0,0 +1,111 @@
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+// 按字节预算淘汰的线程安全 LRU 缓存，值的大小由调用方在插入时给出
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class LruCache
+{
+public:
+    LruCache(std::size_t budget) :
+        mBudget(budget)
+    {
+    }
+
+    std::optional<Value> get(const Key &key)
+    {
+        std::unique_lock lock{this->mMutex};
+        auto             iter = this->mIndex.find(key);
+        if (iter == this->mIndex.end())
+            return std::nullopt;
+        this->mEntries.splice(this->mEntries.begin(), this->mEntries, iter->second);
+        return iter->second->value;
+    }
+
+    // 超过整个预算的值不会被缓存
+    void put(const Key &key, Value value, std::size_t bytes)
+    {
+        std::unique_lock lock{this->mMutex};
+        if (bytes > this->mBudget)
+            return;
+        auto iter = this->mIndex.find(key);
+        if (iter != this->mIndex.end())
+            this->eraseEntry(iter->second);
+        this->mEntries.emplace_front(key, std::move(value), bytes);
+        this->mIndex.emplace(key, this->mEntries.begin());
+        this->mBytes += bytes;
+        this->shrinkToBudget();
+    }
+
+    template <typename Pred>
+    void eraseIf(Pred pred)
+    {
+        std::unique_lock lock{this->mMutex};
+        for (auto iter = this->mEntries.begin(); iter != this->mEntries.end();)
+        {
+            auto next = std::next(iter);
+            if (pred(iter->key, iter->value))
+                this->eraseEntry(iter);
+            iter = next;
+        }
+    }
+
+    void clear()
+    {
+        std::unique_lock lock{this->mMutex};
+        this->mEntries.clear();
+        this->mIndex.clear();
+        this->mBytes = 0;
+    }
+
+    void setBudget(std::size_t budget)
+    {
+        std::unique_lock lock{this->mMutex};
+        this->mBudget = budget;
+        this->shrinkToBudget();
+    }
+
+    std::size_t budget() const
+    {
+        std::unique_lock lock{this->mMutex};
+        return this->mBudget;
+    }
+
+    std::size_t bytes() const
+    {
+        std::unique_lock lock{this->mMutex};
+        return this->mBytes;
+    }
+
+private:
+    struct Entry
+    {
+        Key         key;
+        Value       value;
+        std::size_t bytes;
+    };
+
+    using EntryIter = typename std::list<Entry>::iterator;
+
+    mutable std::mutex                       mMutex;
+    std::list<Entry>                         mEntries; // 表头为最近使用
+    std::unordered_map<Key, EntryIter, Hash> mIndex;
+    std::size_t                              mBudget;
+    std::size_t                              mBytes = 0;
+
+    void eraseEntry(EntryIter iter)
+    {
+        this->mBytes -= iter->bytes;
+        this->mIndex.erase(iter->key);
+        this->mEntries.erase(iter);
+    }
+
+    void shrinkToBudget()
+    {
+        while (this->mBytes > this->mBudget)
+            this->eraseEntry(std::prev(this->mEntries.end()));
+    }
+};
@@ -0,0 +1,79 @@
+#include "MemoryPressureMonitor.h"
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+namespace
+{
+    // 本进程所在的 cgroup v2 的 memory.pressure，/proc/self/cgroup 中 v2 一行形如 "0::/path"
+    std::string cgroupPressurePath()
+    {
+        std::ifstream file{"/proc/self/cgroup"};
+        for (std::string line; std::getline(file, line);)
+        {
+            if (line.starts_with("0::"))
+                return "/sys/fs/cgroup" + line.substr(3) + "/memory.pressure";
+        }
+        return {};
+    }
+} // namespace
+
+std::unique_ptr<MemoryPressureMonitor> MemoryPressureMonitor::start(Callback callback, std::chrono::milliseconds interval)
+{
+    for (const std::string &path : {cgroupPressurePath(), std::string{"/proc/pressure/memory"}})
+    {
+        if (!path.empty() && MemoryPressureMonitor::readStall(path))
+            return std::make_unique<MemoryPressureMonitor>(path, std::move(callback), interval);
+    }
+    return nullptr;
+}
+
+MemoryPressureMonitor::MemoryPressureMonitor(std::string path, Callback callback, std::chrono::milliseconds interval) :
+    mPath(std::move(path)),
+    mCallback(std::move(callback)),
+    mInterval(interval),
+    mThread([this](std::stop_token stopToken) { this->threadFunc(stopToken); })
+{
+}
+
+MemoryPressureMonitor::~MemoryPressureMonitor()
+{
+    this->mThread.request_stop();
+    this->mThread.join();
+}
+
+// 格式为 "some avg10=1.23 avg60=0.50 avg300=0.10 total=12345"
+std::optional<double> MemoryPressureMonitor::readStall(const std::string &path)
+{
+    std::ifstream file{path};
+    for (std::string line; std::getline(file, line);)
+    {
+        if (!line.starts_with("some "))
+            continue;
+        std::istringstream fields{line.substr(5)};
+        for (std::string field; fields >> field;)
+        {
+            if (field.starts_with("avg10="))
+                return std::strtod(field.c_str() + 6, nullptr);
+        }
+    }
+    return std::nullopt;
+}
+
+void MemoryPressureMonitor::threadFunc(std::stop_token stopToken)
+{
+#if _POSIX_THREADS
+    pthread_setname_np(pthread_self(), "Memory Pressure");
+#endif
+    while (true)
+    {
+        {
+            std::unique_lock lock{this->mStopMutex};
+            this->mStopCondi.wait_for(lock, stopToken, this->mInterval, [] { return false; });
+            if (stopToken.stop_requested())
+                return;
+        }
+        if (auto stall = MemoryPressureMonitor::readStall(this->mPath))
+            this->mCallback(*stall);
+    }
+}
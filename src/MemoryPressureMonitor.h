@@ -0,0 +1,44 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+// Linux PSI 内存压力监控
+// 后台线程定期读取 cgroup v2 的 memory.pressure（容器内反映本容器的压力），不可用时读取全系统的 /proc/pressure/memory，
+// 把其中 some avg10（过去 10 秒内至少有一个任务因等待内存而停顿的时间比例，百分数）交给回调
+class MemoryPressureMonitor
+{
+public:
+    using Callback = std::function<void(double stallPercent)>;
+
+    static constexpr std::chrono::milliseconds DefaultInterval{1000};
+
+    // 系统不支持 PSI（内核未开启或非 Linux）时返回 nullptr
+    static std::unique_ptr<MemoryPressureMonitor> start(Callback callback, std::chrono::milliseconds interval = DefaultInterval);
+
+    MemoryPressureMonitor(std::string path, Callback callback, std::chrono::milliseconds interval);
+    ~MemoryPressureMonitor();
+
+    MemoryPressureMonitor(const MemoryPressureMonitor &) = delete;
+    MemoryPressureMonitor &operator=(const MemoryPressureMonitor &) = delete;
+
+    // 读取 PSI 文件中 "some" 一行的 avg10
+    static std::optional<double> readStall(const std::string &path);
+
+private:
+    std::string               mPath;
+    Callback                  mCallback;
+    std::chrono::milliseconds mInterval;
+
+    std::mutex                  mStopMutex;
+    std::condition_variable_any mStopCondi;
+    std::jthread                mThread; // 放在最后，析构时最先停止
+
+    void threadFunc(std::stop_token stopToken);
+};
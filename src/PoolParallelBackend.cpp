@@ -0,0 +1,120 @@
+#include "PoolParallelBackend.h"
+#include <algorithm>
+
+void PoolParallelBackend::attach(WorkerPool &pool)
+{
+    PoolParallelBackend &backend = PoolParallelBackend::instance();
+    auto                 attachment = std::make_shared<Attachment>();
+    attachment->mPool = &pool;
+
+    std::unique_lock lock{backend.mPoolMutex};
+    backend.mPools.push_back(std::move(attachment));
+    backend.mDefaultThreads = static_cast<int>(pool.maxThread());
+}
+
+void PoolParallelBackend::detach(WorkerPool &pool)
+{
+    PoolParallelBackend        &backend = PoolParallelBackend::instance();
+    std::shared_ptr<Attachment> attachment;
+    {
+        std::unique_lock lock{backend.mPoolMutex};
+        auto             iter = std::ranges::find(backend.mPools, &pool, &Attachment::mPool);
+        if (iter == backend.mPools.end())
+            return;
+        attachment = std::move(*iter);
+        backend.mPools.erase(iter);
+        backend.mDefaultThreads = backend.mPools.empty() ? 1 : static_cast<int>(backend.mPools.back()->mPool->maxThread());
+    }
+
+    // 已摘下的线程池不会再被选中，等已经在上面执行的并行区域结束
+    for (uint32_t users; (users = attachment->mUsers.load()) != 0;)
+        attachment->mUsers.wait(users);
+}
+
+PoolParallelBackend &PoolParallelBackend::instance()
+{
+    // OpenCV 同时持有一份引用，进程退出前不会析构
+    static std::shared_ptr<PoolParallelBackend> backend = [] {
+        auto backend = std::make_shared<PoolParallelBackend>();
+        cv::parallel::setParallelForBackend(backend, false);
+        return backend;
+    }();
+    return *backend;
+}
+
+std::shared_ptr<PoolParallelBackend::Attachment> PoolParallelBackend::acquire()
+{
+    std::unique_lock            lock{this->mPoolMutex};
+    WorkerPool                 *current = WorkerPool::currentPool();
+    std::shared_ptr<Attachment> chosen = this->mPools.empty() ? nullptr : this->mPools.back();
+    for (const auto &attachment : this->mPools)
+    {
+        if (attachment->mPool == current)
+            chosen = attachment;
+    }
+    if (chosen)
+        ++chosen->mUsers;
+    return chosen;
+}
+
+void PoolParallelBackend::parallel_for(int tasks, FN_parallel_for_body_cb_t body, void *data)
+{
+    std::shared_ptr<Attachment> attachment = tasks > 1 ? this->acquire() : nullptr;
+
+    // body 抛出异常时也要撤销登记，否则 detach 会一直等下去
+    struct Release
+    {
+        Attachment *mAttachment;
+        ~Release()
+        {
+            if (this->mAttachment && --this->mAttachment->mUsers == 0)
+                this->mAttachment->mUsers.notify_all();
+        }
+    } release{attachment.get()};
+
+    uint32_t chunks = 1;
+    if (attachment)
+    {
+        chunks = std::min(static_cast<uint32_t>(tasks), attachment->mPool->spareThreads() + 1);
+        if (int limit = this->mThreadLimit.load(); limit > 0)
+            chunks = std::min(chunks, static_cast<uint32_t>(limit));
+    }
+    if (chunks <= 1)
+    {
+        body(0, tasks, data);
+        return;
+    }
+
+    // tasks 已经是 OpenCV 划分好的条带数，按块连续分配，条带内的数据在同一线程上
+    attachment->mPool->parallelFor(chunks, [&](uint32_t i) {
+        body(static_cast<int>(int64_t{tasks} * i / chunks), static_cast<int>(int64_t{tasks} * (i + 1) / chunks), data);
+    }, WorkerPool::currentPriority());
+}
+
+// 以下两个查询可能在并行区域内部调用，只读线程局部变量与原子变量，不加锁
+int PoolParallelBackend::getThreadNum() const
+{
+    WorkerPool *pool = WorkerPool::currentPool();
+    return pool ? std::max(pool->currentWorkerIndex(), 0) : 0;
+}
+
+int PoolParallelBackend::getNumThreads() const
+{
+    WorkerPool *pool = WorkerPool::currentPool();
+    int         threads = pool ? static_cast<int>(pool->maxThread()) : this->mDefaultThreads.load();
+    int         limit = this->mThreadLimit.load();
+    return limit > 0 ? std::min(threads, limit) : threads;
+}
+
+// 与 cv::setNumThreads 的约定一致：负数恢复默认，0 表示不并行
+int PoolParallelBackend::setNumThreads(int nThreads)
+{
+    int previous = this->getNumThreads();
+    this->mThreadLimit = nThreads < 0 ? 0 : std::max(nThreads, 1);
+    return previous;
+}
+
+const char *PoolParallelBackend::getName() const
+{
+    return "img-worker-pool";
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "WorkerPool.h"
+#include <opencv2/core/parallel/parallel_backend.hpp>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// OpenCV 的 parallel_for_ 后端，并行区域在压缩线程池上执行，OpenCV 不再另起线程，
+// 整个进程只有线程池这一份线程预算。每次并行时按线程池的空闲程度决定拆成几块：
+// 线程池正忙于处理其他图像时直接在调用线程上串行执行，只有一张大图时才把它拆开。
+// 同时存在多个 Compressor 时各自的线程池都挂在后端上：工作线程发起的并行区域留在它自己的线程池里，
+// 其他线程发起的交给最后挂上、仍然存在的那个
+class PoolParallelBackend : public cv::parallel::ParallelForAPI
+{
+public:
+    // 把 pool 挂到后端上，首次调用时向 OpenCV 注册。pool 析构前必须 detach，全部 detach 之后的并行区域串行执行。
+    // detach 等在 pool 上执行的并行区域结束后返回
+    static void attach(WorkerPool &pool);
+    static void detach(WorkerPool &pool);
+
+    void        parallel_for(int tasks, FN_parallel_for_body_cb_t body, void *data) override;
+    int         getThreadNum() const override;
+    int         getNumThreads() const override;
+    int         setNumThreads(int nThreads) override;
+    const char *getName() const override;
+
+private:
+    struct Attachment
+    {
+        WorkerPool           *mPool;
+        std::atomic<uint32_t> mUsers = 0; // 正在这个线程池上执行的并行区域数，detach 等它归零
+    };
+
+    static PoolParallelBackend &instance();
+
+    // 挑选本次并行区域使用的线程池并登记使用，没有挂上的线程池时返回空
+    std::shared_ptr<Attachment> acquire();
+
+    // 只在挑选、挂上、摘下线程池时短暂持有，执行并行区域期间不持有，
+    // 并行区域里调用 cv::getThreadNum 等也不会与 attach、detach 互相等待
+    std::mutex                               mPoolMutex;
+    std::vector<std::shared_ptr<Attachment>> mPools;              // 按 attach 的先后顺序
+    std::atomic<int>                         mDefaultThreads = 1; // 最后挂上的线程池的线程数，供非工作线程查询
+    std::atomic<int>                         mThreadLimit = 0;    // cv::setNumThreads 设置的上限，0 表示不限
+};
@@ -0,0 +1,235 @@
+#include "PooledMatAllocator.h"
+#include <bit>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace
+{
+    // 大页内存块的 UMatData::handle 指向这里；CPU 端的分配器不会用到 handle，OpenCV 也不会去动它
+    char hugePageTag;
+
+#ifdef __linux__
+    void *mapHugePages(std::size_t length, PooledMatAllocator::HugePages mode)
+    {
+        constexpr std::size_t align = PooledMatAllocator::HugePageSize;
+        if (mode == PooledMatAllocator::HugePages::HugeTlb)
+        {
+            void *block = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (21 << MAP_HUGE_SHIFT), -1, 0);
+            if (block != MAP_FAILED)
+                return block;
+        }
+
+        // 多映射 2MB 再裁掉首尾，起始地址按 2MB 对齐，内核才能整页地用大页填充
+        std::size_t mapped = length + align;
+        void       *raw = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED)
+            return nullptr;
+        uintptr_t begin = reinterpret_cast<uintptr_t>(raw);
+        uintptr_t aligned = (begin + align - 1) & ~(align - 1);
+        if (aligned != begin)
+            munmap(raw, aligned - begin);
+        if (std::size_t tail = begin + mapped - (aligned + length))
+            munmap(reinterpret_cast<void *>(aligned + length), tail);
+
+        void *block = reinterpret_cast<void *>(aligned);
+        madvise(block, length, MADV_HUGEPAGE);
+        return block;
+    }
+#endif
+} // namespace
+
+PooledMatAllocator &PooledMatAllocator::instance()
+{
+    static PooledMatAllocator *allocator = new PooledMatAllocator;
+    return *allocator;
+}
+
+cv::Mat PooledMatAllocator::makeMat()
+{
+    cv::Mat mat;
+    mat.allocator = &PooledMatAllocator::instance();
+    return mat;
+}
+
+// 步长计算与 OpenCV 自带的 StdMatAllocator 相同，只替换了内存的来源
+cv::UMatData *PooledMatAllocator::allocate(int dims, const int *sizes, int type, void *data, size_t *step, cv::AccessFlag,
+                                           cv::UMatUsageFlags) const
+{
+    std::size_t total = CV_ELEM_SIZE(type);
+    for (int i = dims - 1; i >= 0; --i)
+    {
+        if (step)
+        {
+            if (data && step[i] != CV_AUTOSTEP)
+                total = step[i];
+            else
+                step[i] = total;
+        }
+        total *= sizes[i];
+    }
+
+    uchar    *block = static_cast<uchar *>(data);
+    BlockKind kind = BlockKind::Heap;
+    if (!block && total >= MinPooledSize)
+    {
+        std::size_t blockSize = PooledMatAllocator::sizeClass(total);
+        HugePages   mode = this->mHugePages.load(std::memory_order_relaxed);
+        if (mode != HugePages::Off && total >= this->mHugePageThreshold.load(std::memory_order_relaxed))
+        {
+            kind = BlockKind::HugePage;
+            blockSize = cv::alignSize(blockSize, static_cast<int>(HugePageSize));
+        }
+
+        std::unique_lock lock{this->mMutex};
+        auto            &freeBlocks = this->mFreeBlocks[kind];
+        auto             iter = freeBlocks.find(blockSize);
+        if (iter != freeBlocks.end() && !iter->second.empty())
+        {
+            block = static_cast<uchar *>(iter->second.back());
+            iter->second.pop_back();
+            this->mCachedBytes -= blockSize;
+        }
+        lock.unlock();
+        if (!block)
+            block = static_cast<uchar *>(PooledMatAllocator::allocBlock(blockSize, kind, mode));
+        // 大页映射失败时退回普通内存
+        if (!block)
+        {
+            kind = BlockKind::Heap;
+            block = static_cast<uchar *>(cv::fastMalloc(PooledMatAllocator::sizeClass(total)));
+        }
+    }
+    else if (!block)
+    {
+        block = static_cast<uchar *>(cv::fastMalloc(total));
+    }
+
+    cv::UMatData *u = new cv::UMatData(this);
+    u->data = u->origdata = block;
+    u->size = total;
+    if (kind == BlockKind::HugePage)
+        u->handle = &hugePageTag;
+    if (data)
+        u->flags |= cv::UMatData::USER_ALLOCATED;
+    return u;
+}
+
+bool PooledMatAllocator::allocate(cv::UMatData *data, cv::AccessFlag, cv::UMatUsageFlags) const
+{
+    return data != nullptr;
+}
+
+void PooledMatAllocator::deallocate(cv::UMatData *u) const
+{
+    if (!u)
+        return;
+    if (!(u->flags & cv::UMatData::USER_ALLOCATED))
+    {
+        void       *block = u->origdata;
+        BlockKind   kind = u->handle == &hugePageTag ? BlockKind::HugePage : BlockKind::Heap;
+        std::size_t blockSize = u->size;
+        if (u->size >= MinPooledSize)
+        {
+            blockSize = PooledMatAllocator::sizeClass(u->size);
+            if (kind == BlockKind::HugePage)
+                blockSize = cv::alignSize(blockSize, static_cast<int>(HugePageSize));
+            std::unique_lock lock{this->mMutex};
+            if (this->mCachedBytes + blockSize <= this->mBudget)
+            {
+                this->mFreeBlocks[kind][blockSize].push_back(block);
+                this->mCachedBytes += blockSize;
+                block = nullptr;
+            }
+        }
+        if (block)
+            PooledMatAllocator::freeBlock(block, blockSize, kind);
+    }
+    delete u;
+}
+
+void PooledMatAllocator::setBudget(std::size_t bytes)
+{
+    {
+        std::unique_lock lock{this->mMutex};
+        this->mBudget = bytes;
+        if (this->mCachedBytes <= bytes)
+            return;
+    }
+    this->trim();
+}
+
+std::size_t PooledMatAllocator::cachedBytes() const
+{
+    std::unique_lock lock{this->mMutex};
+    return this->mCachedBytes;
+}
+
+void PooledMatAllocator::trim()
+{
+    std::unordered_map<std::size_t, std::vector<void *>> freeBlocks[BlockKind::_count];
+    {
+        std::unique_lock lock{this->mMutex};
+        for (int kind = 0; kind < BlockKind::_count; ++kind)
+            freeBlocks[kind].swap(this->mFreeBlocks[kind]);
+        this->mCachedBytes = 0;
+    }
+    for (int kind = 0; kind < BlockKind::_count; ++kind)
+    {
+        for (auto &&[blockSize, blocks] : freeBlocks[kind])
+        {
+            for (void *block : blocks)
+                PooledMatAllocator::freeBlock(block, blockSize, static_cast<BlockKind>(kind));
+        }
+    }
+}
+
+bool PooledMatAllocator::setHugePages(HugePages mode, std::size_t threshold)
+{
+#ifdef __linux__
+    this->mHugePageThreshold.store(std::max(threshold, MinPooledSize), std::memory_order_relaxed);
+    this->mHugePages.store(mode, std::memory_order_relaxed);
+    // 已缓存的块仍按原来的方式分配，切换后让它们自然淘汰即可
+    return true;
+#else
+    // Windows 的大页需要 SeLockMemoryPrivilege 且不可换出，不适合做通用的像素内存
+    return mode == HugePages::Off;
+#endif
+}
+
+PooledMatAllocator::HugePages PooledMatAllocator::hugePages() const
+{
+    return this->mHugePages.load(std::memory_order_relaxed);
+}
+
+void *PooledMatAllocator::allocBlock(std::size_t blockSize, BlockKind kind, HugePages mode)
+{
+#ifdef __linux__
+    if (kind == BlockKind::HugePage)
+        return mapHugePages(blockSize, mode);
+#endif
+    (void)mode;
+    return kind == BlockKind::Heap ? cv::fastMalloc(blockSize) : nullptr;
+}
+
+void PooledMatAllocator::freeBlock(void *block, std::size_t blockSize, BlockKind kind)
+{
+#ifdef __linux__
+    if (kind == BlockKind::HugePage)
+    {
+        munmap(block, blockSize);
+        return;
+    }
+#endif
+    (void)blockSize;
+    (void)kind;
+    cv::fastFree(block);
+}
+
+std::size_t PooledMatAllocator::sizeClass(std::size_t bytes)
+{
+    std::size_t base = std::bit_floor(bytes);
+    std::size_t quarter = std::max<std::size_t>(base / 4, 1);
+    return (bytes + quarter - 1) / quarter * quarter;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// 按尺寸级别复用像素内存的 cv::MatAllocator
+// 大块内存直接交给 malloc 时每次都会 mmap/munmap，新页面首次访问还要逐页缺页。
+// 这里把释放的内存按尺寸级别留给下一个同级别的 Mat，缓存总量不超过预算；小于 MinPooledSize 的分配直接走 fastMalloc。
+// 整个进程共用一个实例且永不析构，用它分配的 Mat 可以活得比任何 Compressor 都久
+class PooledMatAllocator : public cv::MatAllocator
+{
+public:
+    // 大块像素内存使用 2MB 大页，减少几十上百兆像素的大图首次访问时的缺页次数与 TLB 压力
+    enum class HugePages : uint8_t
+    {
+        Off,
+        Transparent, // 按 2MB 对齐映射并 madvise(MADV_HUGEPAGE)，由内核在缺页时尽量分配透明大页
+        HugeTlb,     // MAP_HUGETLB 从预留的 hugetlbfs 大页池分配，池里不够时退回 Transparent
+    };
+
+    static PooledMatAllocator &instance();
+
+    // 返回一个使用本分配器的空 Mat，create 或作为 OpenCV 函数的输出时从池中取内存
+    static cv::Mat makeMat();
+
+    cv::UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step, cv::AccessFlag flags,
+                           cv::UMatUsageFlags usageFlags) const override;
+    bool          allocate(cv::UMatData *data, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const override;
+    void          deallocate(cv::UMatData *data) const override;
+
+    // 预算为 0 时不缓存，释放的内存立即归还系统
+    void        setBudget(std::size_t bytes);
+    std::size_t cachedBytes() const;
+    void        trim();
+
+    // 不小于 threshold 的内存块使用大页；不支持大页的平台上返回 false，设置不生效
+    bool      setHugePages(HugePages mode, std::size_t threshold = DefaultHugePageThreshold);
+    HugePages hugePages() const;
+
+    static constexpr std::size_t DefaultBudget = 256ull << 20;
+    static constexpr std::size_t MinPooledSize = 64ull << 10;
+    static constexpr std::size_t HugePageSize = 2ull << 20;
+    static constexpr std::size_t DefaultHugePageThreshold = 32ull << 20;
+
+private:
+    PooledMatAllocator() = default;
+
+    enum BlockKind : uint8_t
+    {
+        Heap,     // fastMalloc
+        HugePage, // mmap，UMatData::handle 指向 hugePageTag 以便释放时区分
+        _count
+    };
+
+    // 向上取整到 2^k 的 1、1.25、1.5、1.75 倍，浪费不超过 25%
+    static std::size_t sizeClass(std::size_t bytes);
+
+    static void *allocBlock(std::size_t blockSize, BlockKind kind, HugePages mode);
+    static void  freeBlock(void *block, std::size_t blockSize, BlockKind kind);
+
+    mutable std::mutex                                           mMutex;
+    mutable std::unordered_map<std::size_t, std::vector<void *>> mFreeBlocks[BlockKind::_count]; // 尺寸级别 -> 空闲内存块
+    mutable std::size_t                                          mCachedBytes = 0;
+    std::size_t                                                  mBudget = DefaultBudget;
+
+    std::atomic<HugePages>   mHugePages = HugePages::Off;
+    std::atomic<std::size_t> mHugePageThreshold = DefaultHugePageThreshold;
+};
@@ -0,0 +1,617 @@
+#include "WorkerPool.h"
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <utility>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace
+{
+    // 当前线程所属的线程池及其在池中的下标，用于把工作线程内部提交的任务放进本地队列
+    thread_local WorkerPool *tl_currentPool = nullptr;
+    thread_local uint32_t    tl_workerIndex = 0;
+
+    thread_local WorkerPool::Priority tl_jobPriority = WorkerPool::Priority::Interactive;
+
+    std::optional<std::string> readEnv(const char *name)
+    {
+#ifdef _MSC_VER
+        char       *value = nullptr;
+        std::size_t length = 0;
+        if (_dupenv_s(&value, &length, name) != 0 || !value)
+            return std::nullopt;
+        std::string result = value;
+        free(value);
+        return result;
+#else
+        const char *value = std::getenv(name);
+        if (!value)
+            return std::nullopt;
+        return value;
+#endif
+    }
+
+#ifdef __linux__
+    uint32_t affinityCpuCount()
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) != 0)
+            return 0;
+        return static_cast<uint32_t>(CPU_COUNT(&set));
+    }
+
+    // quota / period 向上取整，无限制或读取失败返回 0
+    uint32_t quotaToCpus(double quota, double period)
+    {
+        if (quota <= 0 || period <= 0)
+            return 0;
+        return static_cast<uint32_t>(std::max(std::ceil(quota / period), 1.0));
+    }
+
+    // cgroup v2：cpu.max 为 "<quota|max> <period>"，从本进程所在的 cgroup 一直向上取最严格的限制
+    uint32_t cgroupV2CpuLimit(const std::string &path)
+    {
+        uint32_t limit = 0;
+        for (std::string dir = path;; dir = dir.substr(0, dir.rfind('/')))
+        {
+            std::ifstream file{"/sys/fs/cgroup" + dir + "/cpu.max"};
+            std::string   quota;
+            double        period = 0;
+            if (file >> quota >> period && quota != "max")
+            {
+                if (uint32_t cpus = quotaToCpus(std::atof(quota.c_str()), period); cpus != 0)
+                    limit = limit == 0 ? cpus : std::min(limit, cpus);
+            }
+            if (dir.empty() || dir == "/")
+                break;
+        }
+        return limit;
+    }
+
+    // cgroup v1：cpu.cfs_quota_us 为 -1 表示不限。容器里通常只挂载了自己的 cgroup，路径不存在时读挂载点根目录
+    uint32_t cgroupV1CpuLimit(const std::string &controllers, const std::string &path)
+    {
+        for (const std::string &mount : {"/sys/fs/cgroup/" + controllers, std::string{"/sys/fs/cgroup/cpu,cpuacct"}, std::string{"/sys/fs/cgroup/cpu"}})
+        {
+            for (const std::string &dir : {mount + path, mount})
+            {
+                std::ifstream quotaFile{dir + "/cpu.cfs_quota_us"}, periodFile{dir + "/cpu.cfs_period_us"};
+                double        quota = 0, period = 0;
+                if (quotaFile >> quota && periodFile >> period)
+                    return quotaToCpus(quota, period);
+            }
+        }
+        return 0;
+    }
+
+    uint32_t cgroupCpuLimit()
+    {
+        // 每行为 "<id>:<controllers>:<path>"，v2 的 id 为 0、controllers 为空
+        std::ifstream file{"/proc/self/cgroup"};
+        for (std::string line; std::getline(file, line);)
+        {
+            std::size_t first = line.find(':'), second = line.find(':', first + 1);
+            if (first == std::string::npos || second == std::string::npos)
+                continue;
+            std::string controllers = line.substr(first + 1, second - first - 1);
+            std::string path = line.substr(second + 1);
+            if (controllers.empty())
+                return cgroupV2CpuLimit(path);
+            for (std::size_t begin = 0, end; begin <= controllers.size(); begin = end + 1)
+            {
+                end = std::min(controllers.find(',', begin), controllers.size());
+                if (controllers.compare(begin, end - begin, "cpu") == 0)
+                    return cgroupV1CpuLimit(controllers, path);
+            }
+        }
+        return 0;
+    }
+#endif
+} // namespace
+
+uint32_t WorkerPool::defaultThreadCount()
+{
+    static const uint32_t count = []() -> uint32_t {
+        if (auto value = readEnv("IMG_THREADS"))
+        {
+            int threads = std::atoi(value->c_str());
+            if (threads > 0)
+                return static_cast<uint32_t>(threads);
+        }
+
+        uint32_t threads = std::max(std::thread::hardware_concurrency(), 1u);
+#ifdef __linux__
+        for (uint32_t limit : {affinityCpuCount(), cgroupCpuLimit()})
+        {
+            if (limit != 0)
+                threads = std::min(threads, limit);
+        }
+#endif
+        return threads;
+    }();
+    return count;
+}
+
+WorkerPool::WorkerPool(uint32_t maxThread) :
+    mMaxThread(std::max(maxThread, 1u)),
+    mWorkers(std::make_unique<Worker[]>(this->mMaxThread)),
+    mActiveLimit(this->mMaxThread),
+    mConcurrencyCap(this->mMaxThread)
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::unique_lock lock{this->mParkMutex};
+        this->mThreadDestroy = true;
+    }
+    this->mParkCondi.notify_all();
+
+    // 工作线程会先把剩余任务执行完再退出，必须在其他成员析构前等待它们结束
+    uint32_t workerCount = this->mWorkerCount.load();
+    for (uint32_t i = 0; i < workerCount; ++i)
+    {
+        if (this->mWorkers[i].mThread.joinable())
+            this->mWorkers[i].mThread.join();
+    }
+
+    for (auto &&queue : this->mInjectionQueues)
+    {
+        for (JobNode *node = queue.takeAll(); node;)
+            delete std::exchange(node, node->mNext);
+    }
+    for (uint32_t i = 0; i < this->mMaxThread; ++i)
+    {
+        for (auto &&deque : this->mWorkers[i].mDeques)
+        {
+            for (JobNode *node : deque)
+                delete node;
+        }
+    }
+}
+
+void WorkerPool::submit(Job job, Priority priority)
+{
+    this->enqueue(new JobNode{std::move(job), priority});
+}
+
+void WorkerPool::enqueue(JobNode *node)
+{
+    ++this->mQueuedJobs[node->mPriority];
+    if (tl_currentPool == this)
+        this->pushLocal(this->mWorkers[tl_workerIndex], node, node->mPriority);
+    else
+        this->mInjectionQueues[node->mPriority].push(node);
+    this->wakeOrSpawn();
+}
+
+void WorkerPool::parallelFor(uint32_t count, const std::function<void(uint32_t)> &body, Priority priority)
+{
+    if (count == 0)
+        return;
+
+    // 帮手任务可能在 parallelFor 返回后才被执行，共享状态用 shared_ptr 延长生命周期；
+    // 帮手只有领到下标才会访问 body，而领完下标之前 parallelFor 不会返回
+    struct SharedState
+    {
+        std::atomic<uint32_t>                 next = 0;
+        std::atomic<uint32_t>                 finished = 0;
+        uint32_t                              count;
+        const std::function<void(uint32_t)> *body;
+    };
+    auto state = std::make_shared<SharedState>();
+    state->count = count;
+    state->body = &body;
+
+    auto work = [state]() {
+        for (uint32_t i; (i = state->next.fetch_add(1)) < state->count;)
+        {
+            (*state->body)(i);
+            if (state->finished.fetch_add(1) + 1 == state->count)
+                state->finished.notify_all();
+        }
+    };
+
+    // 帮手任务可能什么都没领到就结束，不计入吞吐量，否则拆得越细吞吐量看起来越高
+    uint32_t helpers = std::min(count, this->mMaxThread) - 1;
+    for (uint32_t i = 0; i < helpers; ++i)
+        this->enqueue(new JobNode{work, priority, true});
+    work();
+
+    for (uint32_t finished; (finished = state->finished.load()) != count;)
+        state->finished.wait(finished);
+}
+
+uint32_t WorkerPool::spareThreads() const
+{
+    int64_t spare = int64_t{this->mIdleThread.load()} + this->activeLimit() - this->mLiveThread.load();
+    for (auto &&count : this->mQueuedJobs)
+        spare -= count.load();
+    return static_cast<uint32_t>(std::max<int64_t>(spare, 0));
+}
+
+void WorkerPool::setIdleTimeout(std::chrono::milliseconds timeout)
+{
+    this->mIdleTimeoutMs = std::max<int64_t>(timeout.count(), 0);
+    // 让正在等待的线程按新的超时重新计时
+    std::unique_lock lock{this->mParkMutex};
+    this->mParkCondi.notify_all();
+}
+
+void WorkerPool::setMinThread(uint32_t minThread)
+{
+    this->mMinThread = std::min(minThread, this->mMaxThread);
+}
+
+void WorkerPool::setAdaptiveConcurrency(bool enabled)
+{
+    {
+        std::unique_lock lock{this->mControlMutex};
+        this->mAdaptive = enabled;
+        this->mActiveLimit = this->mMaxThread;
+        this->mWindowBegin = std::chrono::steady_clock::now();
+        this->mCompletedJobs = 0;
+        this->mLastThroughput = 0.0;
+        this->mControlStep = 1;
+    }
+    if (this->hasQueuedJob())
+        this->wakeOrSpawn();
+}
+
+void WorkerPool::setConcurrencyCap(uint32_t cap)
+{
+    cap = cap == 0 ? this->mMaxThread : std::min(cap, this->mMaxThread);
+    if (this->mConcurrencyCap.exchange(cap) < cap && this->hasQueuedJob())
+        this->wakeOrSpawn();
+}
+
+uint32_t WorkerPool::concurrencyCap() const
+{
+    return this->mConcurrencyCap.load();
+}
+
+uint32_t WorkerPool::activeLimit() const
+{
+    return std::min(this->mActiveLimit.load(), this->mConcurrencyCap.load());
+}
+
+int WorkerPool::currentWorkerIndex() const
+{
+    return tl_currentPool == this ? static_cast<int>(tl_workerIndex) : -1;
+}
+
+WorkerPool *WorkerPool::currentPool()
+{
+    return tl_currentPool;
+}
+
+WorkerPool::Priority WorkerPool::currentPriority()
+{
+    return tl_jobPriority;
+}
+
+void WorkerPool::InjectionQueue::push(JobNode *node)
+{
+    node->mNext = this->mHead.load(std::memory_order_relaxed);
+    while (!this->mHead.compare_exchange_weak(node->mNext, node))
+        ;
+}
+
+WorkerPool::JobNode *WorkerPool::InjectionQueue::takeAll()
+{
+    return this->mHead.exchange(nullptr);
+}
+
+void WorkerPool::workerThreadFunc(uint32_t index)
+{
+#if _POSIX_THREADS
+    pthread_setname_np(pthread_self(), "Compressing Thread");
+#endif
+    tl_currentPool = this;
+    tl_workerIndex = index;
+
+    while (true)
+    {
+        // 领取任务前检查上限，上限调低后多出来的线程不再开始新任务
+        if (this->mLiveThread.load() > this->activeLimit() && this->tryRetire(index, false))
+            return;
+
+        JobNode *node = this->pickJob(index);
+        if (node)
+        {
+            tl_jobPriority = node->mPriority;
+            node->mJob();
+            if (!node->mHelper)
+                ++this->mCompletedJobs;
+            delete node;
+            if (this->mAdaptive.load(std::memory_order_relaxed))
+                this->adjustConcurrency();
+            continue;
+        }
+
+        // 先登记为空闲再检查一次队列，与 wakeOrSpawn 先入队后读 mIdleThread 配合，避免丢失唤醒
+        bool timedOut = false;
+        {
+            std::unique_lock lock{this->mParkMutex};
+            ++this->mIdleThread;
+            if (!this->hasQueuedJob())
+            {
+                if (this->mThreadDestroy)
+                {
+                    --this->mIdleThread;
+                    break;
+                }
+                int64_t timeout = this->mIdleTimeoutMs.load();
+                if (timeout == 0)
+                    this->mParkCondi.wait(lock);
+                else
+                    timedOut = this->mParkCondi.wait_for(lock, std::chrono::milliseconds{timeout}) == std::cv_status::timeout;
+            }
+            --this->mIdleThread;
+        }
+        if (timedOut && this->tryRetire(index, true))
+            return;
+    }
+}
+
+// 先减少 mLiveThread 再检查队列，与 wakeOrSpawn 先入队、再读 mIdleThread 和 mLiveThread 配合：
+// 空闲退出时要么这里看到新任务而放弃退出，要么提交方看到线程数不足而创建新线程，任务不会没人执行。
+// 超出上限退出时把本地队列交还注入队列，并唤醒一个等待中的线程接手（它同样超出上限时会继续往下传）。
+// 槽位在持有 mSpawnMutex 时标记为空闲，复用槽位的线程会先 join 本线程，本线程返回后不能再访问成员
+bool WorkerPool::tryRetire(uint32_t index, bool idle)
+{
+    Worker          &self = this->mWorkers[index];
+    std::unique_lock lock{this->mSpawnMutex};
+    uint32_t         live = this->mLiveThread.load();
+    if (idle ? live <= this->mMinThread.load() : live <= this->activeLimit())
+        return false;
+    if (idle)
+    {
+        for (auto &&size : self.mDequeSizes)
+        {
+            if (size.load() != 0)
+                return false;
+        }
+    }
+
+    --this->mLiveThread;
+    if (idle && this->hasQueuedJob())
+    {
+        ++this->mLiveThread;
+        return false;
+    }
+
+    if (!idle)
+    {
+        {
+            // 按先进先出的顺序压栈，takeInjected 反转后仍是原来的顺序
+            std::unique_lock dequeLock{self.mDequeMutex};
+            for (uint8_t level = 0; level < Priority::_count; ++level)
+            {
+                for (JobNode *node : self.mDeques[level])
+                    this->mInjectionQueues[level].push(node);
+                self.mDeques[level].clear();
+                self.mDequeSizes[level] = 0;
+            }
+        }
+        if (this->hasQueuedJob() && this->mIdleThread.load() > 0)
+        {
+            std::unique_lock parkLock{this->mParkMutex};
+            this->mParkCondi.notify_one();
+        }
+    }
+    self.mAlive = false;
+    return true;
+}
+
+// 爬山法：队列有积压时每个采样周期比较一次吞吐量，上次调整带来了提升就沿同一方向继续，否则反向。
+// 没有积压时吞吐量只取决于提交速度，不能说明线程数是否合适，只重置基准
+void WorkerPool::adjustConcurrency()
+{
+    std::unique_lock lock{this->mControlMutex, std::try_to_lock};
+    if (!lock.owns_lock() || !this->mAdaptive)
+        return;
+    auto                          now = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed = now - this->mWindowBegin;
+    if (elapsed < ControlInterval)
+        return;
+
+    double throughput = this->mCompletedJobs.exchange(0) / elapsed.count();
+    this->mWindowBegin = now;
+    if (!this->hasQueuedJob())
+    {
+        this->mLastThroughput = 0.0;
+        return;
+    }
+
+    if (this->mLastThroughput > 0.0 && throughput < this->mLastThroughput * (1.0 + ControlTolerance))
+        this->mControlStep = -this->mControlStep;
+    this->mLastThroughput = throughput;
+
+    int64_t  lowest = std::max<uint32_t>(this->mMinThread.load(), 1);
+    int64_t  limit = std::clamp<int64_t>(int64_t{this->mActiveLimit.load()} + this->mControlStep, lowest, this->mMaxThread);
+    uint32_t previous = this->mActiveLimit.exchange(static_cast<uint32_t>(limit));
+    if (limit == previous)
+        this->mControlStep = -this->mControlStep; // 到达边界，下次往回试
+    else if (limit > previous)
+        this->wakeOrSpawn();
+}
+
+WorkerPool::JobNode *WorkerPool::pickJob(uint32_t index)
+{
+    Worker &self = this->mWorkers[index];
+
+    // 先照顾被跳过太多次的低优先级任务
+    for (uint8_t level = Priority::_count - 1; level > 0; --level)
+    {
+        if (self.mPassedOver[level] < AgingThreshold || this->mQueuedJobs[level].load() == 0)
+            continue;
+        if (JobNode *node = this->takeJob(index, static_cast<Priority>(level)))
+        {
+            self.mPassedOver[level] = 0;
+            return node;
+        }
+    }
+
+    for (uint8_t level = 0; level < Priority::_count; ++level)
+    {
+        if (this->mQueuedJobs[level].load() == 0)
+            continue;
+        JobNode *node = this->takeJob(index, static_cast<Priority>(level));
+        if (!node)
+            continue;
+        self.mPassedOver[level] = 0;
+        for (uint8_t lower = level + 1; lower < Priority::_count; ++lower)
+        {
+            if (this->mQueuedJobs[lower].load() != 0)
+                ++self.mPassedOver[lower];
+        }
+        return node;
+    }
+    return nullptr;
+}
+
+WorkerPool::JobNode *WorkerPool::takeJob(uint32_t index, Priority priority)
+{
+    Worker  &self = this->mWorkers[index];
+    JobNode *node = this->popLocal(self, priority);
+    if (!node)
+        node = this->takeInjected(self, priority);
+    if (!node)
+        node = this->steal(index, priority);
+    if (node)
+        --this->mQueuedJobs[priority];
+    return node;
+}
+
+WorkerPool::JobNode *WorkerPool::popLocal(Worker &self, Priority priority)
+{
+    if (self.mDequeSizes[priority].load() == 0)
+        return nullptr;
+    std::unique_lock lock{self.mDequeMutex};
+    if (self.mDeques[priority].empty())
+        return nullptr;
+    JobNode *node = self.mDeques[priority].front();
+    self.mDeques[priority].pop_front();
+    --self.mDequeSizes[priority];
+    return node;
+}
+
+WorkerPool::JobNode *WorkerPool::takeInjected(Worker &self, Priority priority)
+{
+    JobNode *list = this->mInjectionQueues[priority].takeAll();
+    if (!list)
+        return nullptr;
+
+    // 栈是后进先出的，反转回提交顺序
+    JobNode *fifo = nullptr;
+    while (list)
+    {
+        JobNode *next = list->mNext;
+        list->mNext = fifo;
+        fifo = list;
+        list = next;
+    }
+
+    JobNode *first = fifo;
+    fifo = fifo->mNext;
+    if (!fifo)
+        return first;
+
+    {
+        std::unique_lock lock{self.mDequeMutex};
+        while (fifo)
+        {
+            self.mDeques[priority].push_back(fifo);
+            ++self.mDequeSizes[priority];
+            fifo = fifo->mNext;
+        }
+    }
+    // 剩下的任务留给其他空闲线程来窃取
+    if (this->mIdleThread.load() > 0)
+    {
+        std::unique_lock lock{this->mParkMutex};
+        this->mParkCondi.notify_all();
+    }
+    return first;
+}
+
+WorkerPool::JobNode *WorkerPool::steal(uint32_t thiefIndex, Priority priority)
+{
+    uint32_t workerCount = this->mWorkerCount.load();
+    for (uint32_t i = 1; i < workerCount; ++i)
+    {
+        Worker &victim = this->mWorkers[(thiefIndex + i) % workerCount];
+        if (victim.mDequeSizes[priority].load() == 0)
+            continue;
+        std::unique_lock lock{victim.mDequeMutex};
+        if (victim.mDeques[priority].empty())
+            continue;
+        JobNode *node = victim.mDeques[priority].back();
+        victim.mDeques[priority].pop_back();
+        --victim.mDequeSizes[priority];
+        return node;
+    }
+    return nullptr;
+}
+
+void WorkerPool::pushLocal(Worker &self, JobNode *node, Priority priority)
+{
+    std::unique_lock lock{self.mDequeMutex};
+    self.mDeques[priority].push_back(node);
+    ++self.mDequeSizes[priority];
+}
+
+bool WorkerPool::hasQueuedJob()
+{
+    for (auto &&count : this->mQueuedJobs)
+    {
+        if (count.load() != 0)
+            return true;
+    }
+    return false;
+}
+
+// 正在工作的线程数已经达到上限时不唤醒也不创建，任务留在队列里，由手头的任务做完后的线程领取；
+// 等待中的线程也算在 mLiveThread 里，只看 mLiveThread 会让全部线程都在等待时没人接手
+void WorkerPool::wakeOrSpawn()
+{
+    uint32_t live = this->mLiveThread.load(), idle = this->mIdleThread.load();
+    if (live - std::min(idle, live) >= this->activeLimit())
+        return;
+    if (idle > 0)
+    {
+        std::unique_lock lock{this->mParkMutex};
+        this->mParkCondi.notify_one();
+        return;
+    }
+    if (this->mLiveThread.load() >= this->activeLimit())
+        return;
+
+    std::unique_lock lock{this->mSpawnMutex};
+    if (this->mLiveThread.load() >= this->activeLimit())
+        return;
+    uint32_t index = 0;
+    while (this->mWorkers[index].mAlive)
+        ++index;
+
+    // 槽位上可能是已经退出的线程，先等它结束
+    Worker &worker = this->mWorkers[index];
+    if (worker.mThread.joinable())
+        worker.mThread.join();
+    worker.mAlive = true;
+    std::fill(std::begin(worker.mPassedOver), std::end(worker.mPassedOver), 0);
+    ++this->mLiveThread;
+    if (index >= this->mWorkerCount.load())
+        this->mWorkerCount.store(index + 1);
+    worker.mThread = std::jthread([this, index]() {
+        this->workerThreadFunc(index);
+    });
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// 工作窃取线程池
+// 外部线程提交的任务进入无锁注入队列，工作线程把注入队列整批取走放进自己的双端队列，
+// 空闲的工作线程从其他线程的双端队列尾部窃取任务。工作线程内部提交的任务直接进入自己的队列。
+// 每个优先级各有一套队列，工作线程总是先取高优先级的任务。
+class WorkerPool
+{
+public:
+    using Job = std::function<void()>;
+
+    enum Priority : uint8_t
+    {
+        Interactive = 0, // 用户正在看的预览
+        Normal,
+        Batch, // 批量任务
+        _count
+    };
+
+    // 低优先级的任务每被跳过这么多次，就会被提前执行一次，保证批量任务不会饿死
+    static constexpr uint32_t AgingThreshold = 16;
+
+    // 默认线程数：环境变量 IMG_THREADS 优先，否则取硬件线程数、CPU 亲和性掩码与 cgroup CPU 配额中最小的，
+    // 容器里按配额而不是宿主机的核数创建线程。只在首次调用时计算
+    static uint32_t defaultThreadCount();
+
+    WorkerPool(uint32_t maxThread);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    void submit(Job job, Priority priority = Priority::Normal);
+
+    // 把 [0, count) 分给线程池并行执行，全部完成后返回。
+    // 调用线程也会领取下标执行，没有空闲线程时就由它自己做完，所以在工作线程里调用也不会死锁
+    void parallelFor(uint32_t count, const std::function<void(uint32_t)> &body, Priority priority = Priority::Interactive);
+
+    uint32_t maxThread() const { return this->mMaxThread; }
+
+    // 空闲超过 timeout 的工作线程退出，至少保留 minThread 个线程随时待命；timeout 为 0 时线程不会退出
+    void setIdleTimeout(std::chrono::milliseconds timeout);
+    void setMinThread(uint32_t minThread);
+
+    // 自适应并发：队列有积压时按吞吐量在 [minThread, maxThread] 内增减同时工作的线程数，
+    // 多加的线程不再带来提升（内存带宽、CPU 配额等瓶颈）时收缩。关闭时上限恢复为 maxThread
+    void setAdaptiveConcurrency(bool enabled);
+
+    // 由外部（如内存压力监控）设置的同时工作线程数上限，与自适应并发的上限取较小者；0 表示取消限制
+    void     setConcurrencyCap(uint32_t cap);
+    uint32_t concurrencyCap() const;
+
+    static constexpr std::chrono::milliseconds DefaultIdleTimeout{10000};
+    static constexpr uint32_t                  DefaultMinThread = 1;
+    static constexpr std::chrono::milliseconds ControlInterval{250};
+    static constexpr double                    ControlTolerance = 0.05; // 吞吐量变化在此比例内视为没有提升
+
+    // 粗略估计还能立即投入使用的线程数：空闲和尚未创建的线程数减去排队中的任务数
+    uint32_t spareThreads() const;
+
+    // 当前线程在本线程池中的下标，不是本线程池的工作线程时返回 -1
+    int currentWorkerIndex() const;
+
+    // 当前线程所属的线程池，不是任何线程池的工作线程时返回 nullptr。只读线程局部变量，不加锁
+    static WorkerPool *currentPool();
+
+    // 当前工作线程正在执行的任务的优先级，不是工作线程时返回 Interactive（调用方正在等待）
+    static Priority currentPriority();
+
+private:
+    struct JobNode
+    {
+        Job      mJob;
+        Priority mPriority;
+        bool     mHelper = false; // parallelFor 的帮手任务，不计入自适应并发的吞吐量
+        JobNode *mNext = nullptr;
+    };
+
+    // 多生产者无锁栈，消费者一次取走整条链表后再反转为先进先出
+    class InjectionQueue
+    {
+    public:
+        void     push(JobNode *node);
+        JobNode *takeAll();
+        bool     empty() const { return this->mHead.load(std::memory_order_acquire) == nullptr; }
+
+    private:
+        std::atomic<JobNode *> mHead = nullptr;
+    };
+
+    struct Worker
+    {
+        std::mutex            mDequeMutex; // 只在本线程与窃取者之间竞争
+        std::deque<JobNode *> mDeques[Priority::_count];
+        std::atomic<uint32_t> mDequeSizes[Priority::_count];
+        uint32_t              mPassedOver[Priority::_count] = {}; // 只由本线程访问
+        bool                  mAlive = false;                     // 持有 mSpawnMutex 时读写
+        std::jthread          mThread;                            // 线程退出后留在槽位上，复用槽位时再 join
+    };
+
+    uint32_t                  mMaxThread;
+    std::unique_ptr<Worker[]> mWorkers;
+    std::atomic<uint32_t>     mWorkerCount = 0; // 用过的槽位数，只增不减，窃取时遍历这些槽位
+    std::atomic<uint32_t>     mLiveThread = 0;  // 正在运行的工作线程数
+    std::mutex                mSpawnMutex;
+
+    std::atomic<int64_t>  mIdleTimeoutMs = DefaultIdleTimeout.count();
+    std::atomic<uint32_t> mMinThread = DefaultMinThread;
+    std::atomic<uint32_t> mActiveLimit; // 同时运行的工作线程数上限，自适应并发关闭时等于 mMaxThread
+    std::atomic<uint32_t> mConcurrencyCap;
+
+    std::atomic<bool>                     mAdaptive = false;
+    std::atomic<uint64_t>                 mCompletedJobs = 0; // 只统计 submit 提交的任务
+    std::mutex                            mControlMutex; // 以下控制器状态只在持有时访问
+    std::chrono::steady_clock::time_point mWindowBegin = std::chrono::steady_clock::now();
+    double                                mLastThroughput = 0.0;
+    int                                   mControlStep = 1;
+
+    InjectionQueue        mInjectionQueues[Priority::_count];
+    std::atomic<uint32_t> mQueuedJobs[Priority::_count]; // 入队前加一，出队后减一
+
+    std::mutex              mParkMutex;
+    std::condition_variable mParkCondi;
+    std::atomic<uint32_t>   mIdleThread = 0;
+    std::atomic<bool>       mThreadDestroy = false;
+
+    void workerThreadFunc(uint32_t index);
+
+    JobNode *pickJob(uint32_t index);
+    JobNode *takeJob(uint32_t index, Priority priority);
+    JobNode *popLocal(Worker &self, Priority priority);
+    JobNode *takeInjected(Worker &self, Priority priority);
+    JobNode *steal(uint32_t thiefIndex, Priority priority);
+
+    void enqueue(JobNode *node);
+    void pushLocal(Worker &self, JobNode *node, Priority priority);
+    bool hasQueuedJob();
+    void wakeOrSpawn();
+
+    uint32_t activeLimit() const;
+    bool     tryRetire(uint32_t index, bool idle);
+    void     adjustConcurrency();
+};
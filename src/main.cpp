@@ -1,10 +1,17 @@
+#include "BatchApp.h"
+#include "Benchmark.h"
 #include "ConsoleApp.h"
 #include "GUIapp.h"
+#include <string_view>
 
 int main(int argc, char *argv[])
 {
     if (argc == 1)
         return GUIapp::start();
+    else if (std::string_view{argv[1]} == "--benchmark")
+        return Benchmark::start(argc, argv);
+    else if (std::string_view{argv[1]} == "--batch")
+        return BatchApp::start(argc, argv);
     else
         return ConsoleApp::start(argc, argv);
 }